@@ -0,0 +1,172 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// A single packed archive of the game's assets, memory-mapped or embedded in the binary.
+
+#include "assets.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char MAGIC[4] = {'T', 'T', 'A', 'S'};
+const uint32_t VERSION = 1;
+const size_t ALIGNMENT = 64;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  uint32_t reserved;
+};
+
+struct IndexEntry {
+  char name[48];
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Embedded archives need not be aligned, so the header and index are copied out rather than cast.
+IndexEntry Entry(const uint8_t* const data, const uint32_t i) {
+  IndexEntry entry;
+  memcpy(&entry, data + sizeof(Header) + i*sizeof(IndexEntry), sizeof(entry));
+  return entry;
+}
+
+}  // namespace
+
+AssetArchive::~AssetArchive() {
+  if (mapped_) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+  }
+}
+
+bool AssetArchive::Map(const char* const path, std::string* const error) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *error = std::string("cannot open ") + path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  const int mmap_errno = errno;
+  close(fd);
+  if (data == MAP_FAILED) {
+    *error = std::string("cannot map ") + path + ": " + strerror(mmap_errno);
+    return false;
+  }
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = st.st_size;
+  mapped_ = true;
+  return Check(error);
+}
+
+bool AssetArchive::Attach(const uint8_t* const data, const size_t size, std::string* const error) {
+  data_ = data;
+  size_ = size;
+  return Check(error);
+}
+
+bool AssetArchive::Check(std::string* const error) {
+  count_ = 0;
+  Header header;
+  if (size_ < sizeof(header)) {
+    *error = "not an asset archive";
+    return false;
+  }
+  memcpy(&header, data_, sizeof(header));
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION ||
+      header.count > (size_ - sizeof(header)) / sizeof(IndexEntry)) {
+    *error = "not an asset archive";
+    return false;
+  }
+  for (uint32_t i = 0; i < header.count; ++i) {
+    const IndexEntry entry = Entry(data_, i);
+    if (!memchr(entry.name, 0, sizeof(entry.name)) || entry.offset > size_ || entry.size > size_ - entry.offset ||
+        (i > 0 && strcmp(Entry(data_, i - 1).name, entry.name) >= 0)) {
+      *error = "corrupt asset archive index";
+      return false;
+    }
+  }
+  count_ = header.count;
+  return true;
+}
+
+const uint8_t* AssetArchive::Find(const std::string& name, size_t* const size) const {
+  // Binary search of the sorted index.
+  uint32_t low = 0;
+  uint32_t high = count_;
+  while (low < high) {
+    const uint32_t middle = low + (high - low) / 2;
+    const IndexEntry entry = Entry(data_, middle);
+    const int order = strcmp(entry.name, name.c_str());
+    if (order == 0) {
+      *size = entry.size;
+      return data_ + entry.offset;
+    }
+    if (order < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return nullptr;
+}
+
+bool AssetArchive::Pack(const char* const path, const std::vector<std::string>& files, std::string* const error) {
+  std::vector<std::string> names(files);
+  std::sort(names.begin(), names.end());
+  std::vector<uint8_t> archive(sizeof(Header) + names.size()*sizeof(IndexEntry));
+  const Header header = {.magic={MAGIC[0], MAGIC[1], MAGIC[2], MAGIC[3]}, .version=VERSION,
+                         .count=static_cast<uint32_t>(names.size()), .reserved=0};
+  memcpy(archive.data(), &header, sizeof(header));
+  for (size_t i = 0; i < names.size(); ++i) {
+    IndexEntry entry = {};
+    if (names[i].size() >= sizeof(entry.name) || (i > 0 && names[i] == names[i - 1])) {
+      *error = "name too long or repeated: " + names[i];
+      return false;
+    }
+    FILE* const file = fopen(names[i].c_str(), "rb");
+    if (!file) {
+      *error = "cannot open " + names[i] + ": " + strerror(errno);
+      return false;
+    }
+    archive.resize((archive.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+    entry.offset = archive.size();
+    uint8_t chunk[1 << 16];
+    for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;) {
+      archive.insert(archive.end(), chunk, chunk + n);
+    }
+    const bool read_error = ferror(file);
+    fclose(file);
+    if (read_error) {
+      *error = "cannot read " + names[i];
+      return false;
+    }
+    entry.size = archive.size() - entry.offset;
+    names[i].copy(entry.name, sizeof(entry.name) - 1);
+    memcpy(&archive[sizeof(Header) + i*sizeof(IndexEntry)], &entry, sizeof(entry));
+  }
+
+  FILE* const out = fopen(path, "wb");
+  if (!out) {
+    *error = std::string("cannot create ") + path + ": " + strerror(errno);
+    return false;
+  }
+  const bool written = fwrite(archive.data(), 1, archive.size(), out) == archive.size();
+  if (fclose(out) != 0 || !written) {
+    *error = std::string("cannot write ") + path;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,52 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// A single packed archive of the game's assets, memory-mapped or embedded in the binary.
+//
+// The archive is a header, an index sorted by name, then the files, each starting on a 64-byte boundary. Integers
+// are in the byte order of the machine that packed it:
+//
+//   "TTAS" uint32 version, uint32 count, uint32 reserved
+//   count x {char name[48], uint64 offset, uint64 size}    Offsets are from the start of the archive.
+
+#ifndef TETRIS_ASSETS_H_
+#define TETRIS_ASSETS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class AssetArchive {
+ public:
+  AssetArchive() : data_(nullptr), size_(0), mapped_(false), count_(0) {}
+  ~AssetArchive();
+  AssetArchive(const AssetArchive&) = delete;
+  AssetArchive& operator=(const AssetArchive&) = delete;
+
+  // Maps an archive file read-only and shared, so that processes running the game share its pages. Returns false
+  // and sets error if it cannot be mapped or is not an archive.
+  bool Map(const char* path, std::string* error);
+
+  // Uses an archive already in memory, such as one linked into the binary, which must outlive this object.
+  bool Attach(const uint8_t* data, size_t size, std::string* error);
+
+  bool empty() const { return count_ == 0; }
+
+  // Returns a view of the named file's bytes and sets size, or nullptr if the archive has no such file. Safe to
+  // call from any thread.
+  const uint8_t* Find(const std::string& name, size_t* size) const;
+
+  // Writes an archive of the files, named by the paths given. Returns false and sets error on failure.
+  static bool Pack(const char* path, const std::vector<std::string>& files, std::string* error);
+
+ private:
+  bool Check(std::string* error);
+
+  const uint8_t* data_;
+  size_t size_;
+  bool mapped_;
+  uint32_t count_;
+};
+
+#endif  // TETRIS_ASSETS_H_
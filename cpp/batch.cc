@@ -0,0 +1,274 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Many boards stepped in lockstep, with vectorized kernels over all of them at once.
+
+#include "batch.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#if !defined(TETRIS_BATCH_SCALAR) && (defined(__AVX2__) || defined(__SSE2__))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Each kernel is written once against a vector of 64-bit lanes, one board per lane. Comparisons produce lanes of
+// all ones or all zeros, and Bits() gathers the top bit of each lane into an integer. TETRIS_BATCH_SCALAR picks the
+// plain words on any target, so that they can be checked on it too.
+#if defined(__AVX2__) && !defined(TETRIS_BATCH_SCALAR)
+struct Lanes {
+  static const int SIZE = 4;
+  static const char* Name() { return "AVX2"; }
+  __m256i v;
+  static Lanes Load(const uint64_t* p) { return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))}; }
+  void Store(uint64_t* p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+  static Lanes Set(const uint64_t x) { return {_mm256_set1_epi64x(x)}; }
+  Lanes operator&(const Lanes o) const { return {_mm256_and_si256(v, o.v)}; }
+  Lanes operator|(const Lanes o) const { return {_mm256_or_si256(v, o.v)}; }
+  Lanes operator+(const Lanes o) const { return {_mm256_add_epi64(v, o.v)}; }
+  Lanes operator>>(const int n) const { return {_mm256_srl_epi64(v, _mm_cvtsi32_si128(n))}; }
+  Lanes AndNot(const Lanes o) const { return {_mm256_andnot_si256(o.v, v)}; }
+  Lanes Equal(const Lanes o) const { return {_mm256_cmpeq_epi64(v, o.v)}; }
+  int Bits() const { return _mm256_movemask_pd(_mm256_castsi256_pd(v)); }
+};
+#elif defined(__SSE2__) && !defined(TETRIS_BATCH_SCALAR)
+struct Lanes {
+  static const int SIZE = 2;
+  static const char* Name() { return "SSE2"; }
+  __m128i v;
+  static Lanes Load(const uint64_t* p) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))}; }
+  void Store(uint64_t* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+  static Lanes Set(const uint64_t x) { return {_mm_set1_epi64x(x)}; }
+  Lanes operator&(const Lanes o) const { return {_mm_and_si128(v, o.v)}; }
+  Lanes operator|(const Lanes o) const { return {_mm_or_si128(v, o.v)}; }
+  Lanes operator+(const Lanes o) const { return {_mm_add_epi64(v, o.v)}; }
+  Lanes operator>>(const int n) const { return {_mm_srl_epi64(v, _mm_cvtsi32_si128(n))}; }
+  Lanes AndNot(const Lanes o) const { return {_mm_andnot_si128(o.v, v)}; }
+  // SSE2 has no 64-bit compare: both 32-bit halves of a lane must be equal.
+  Lanes Equal(const Lanes o) const {
+    const __m128i eq = _mm_cmpeq_epi32(v, o.v);
+    return {_mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)))};
+  }
+  int Bits() const { return _mm_movemask_pd(_mm_castsi128_pd(v)); }
+};
+#else
+struct Lanes {
+  static const int SIZE = 1;
+  static const char* Name() { return "scalar"; }
+  uint64_t v;
+  static Lanes Load(const uint64_t* p) { return {*p}; }
+  void Store(uint64_t* p) const { *p = v; }
+  static Lanes Set(const uint64_t x) { return {x}; }
+  Lanes operator&(const Lanes o) const { return {v & o.v}; }
+  Lanes operator|(const Lanes o) const { return {v | o.v}; }
+  Lanes operator+(const Lanes o) const { return {v + o.v}; }
+  Lanes operator>>(const int n) const { return {v >> n}; }
+  Lanes AndNot(const Lanes o) const { return {v & ~o.v}; }
+  Lanes Equal(const Lanes o) const { return {v == o.v ? ~uint64_t{0} : 0}; }
+  int Bits() const { return v >> 63; }
+};
+#endif
+
+// Takes a where mask is set and b elsewhere.
+Lanes Select(const Lanes mask, const Lanes a, const Lanes b) {
+  return (a & mask) | b.AndNot(mask);
+}
+
+void SetBits(uint64_t* const bits, const int board, const int lanes) {
+  bits[board / 64] |= static_cast<uint64_t>(lanes) << (board % 64);
+}
+
+}  // namespace
+
+BoardBatch::BoardBatch(const int count, const int width, const int height)
+ : count_(count),
+   width_(width),
+   height_(height),
+   stride_((count + Lanes::SIZE - 1) / Lanes::SIZE * Lanes::SIZE),
+   full_row_(width == MAX_WIDTH ? ~uint64_t{0} : (uint64_t{1} << width) - 1),
+   rows_(stride_ * height),
+   scratch_(Lanes::SIZE * height) {
+  if (count < 1 || width < 1 || width > MAX_WIDTH || height < 1) {
+    std::cerr << "BoardBatch: cannot batch " << count << " boards of " << width << "x" << height << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+const char* BoardBatch::InstructionSet() {
+  return Lanes::Name();
+}
+
+void BoardBatch::Load(const int board, const Board& source) {
+  for (int y = 0; y < height_; ++y) {
+    SetRow(board, y, source.Row(y)[0]);
+  }
+}
+
+void BoardBatch::FullRows(const int y, uint64_t* const full) const {
+  std::fill(full, full + (count_ + 63) / 64, 0);
+  const Lanes full_row = Lanes::Set(full_row_);
+  const uint64_t* const row = &rows_[y*stride_];
+  for (int b = 0; b < stride_; b += Lanes::SIZE) {
+    SetBits(full, b, Lanes::Load(row + b).Equal(full_row).Bits());
+  }
+  // The padding boards past count are empty, so they never report full rows.
+}
+
+void BoardBatch::ClearFullRows(int* const lines) {
+  std::fill(lines, lines + count_, 0);
+  const Lanes full_row = Lanes::Set(full_row_);
+  const Lanes zero = Lanes::Set(0);
+  for (int b = 0; b < stride_; b += Lanes::SIZE) {
+    // Each pass removes the lowest full row of each board: walking up from the bottom, once a board has passed a
+    // full row every row takes the value of the row above it.
+    for (bool removed = true; removed;) {
+      Lanes shifting = zero;
+      for (int y = height_ - 1; y >= 0; --y) {
+        uint64_t* const row = &rows_[y*stride_ + b];
+        const Lanes current = Lanes::Load(row);
+        shifting = shifting | current.Equal(full_row);
+        const Lanes above = y > 0 ? Lanes::Load(row - stride_) : zero;
+        Select(shifting, above, current).Store(row);
+      }
+      const int bits = shifting.Bits();
+      for (int l = 0; l < Lanes::SIZE && b + l < count_; ++l) {
+        lines[b + l] += (bits >> l) & 1;
+      }
+      removed = bits != 0;
+    }
+  }
+}
+
+void BoardBatch::Collides(const PieceMask& piece, const int x, const int y, uint64_t* const hits) const {
+  const int words = (count_ + 63) / 64;
+  if (x < 0 || x + piece.width > width_ || y < 0 || y + piece.height > height_) {
+    std::fill(hits, hits + words, ~uint64_t{0});
+    return;
+  }
+  std::fill(hits, hits + words, 0);
+  const Lanes zero = Lanes::Set(0);
+  for (int b = 0; b < stride_; b += Lanes::SIZE) {
+    Lanes hit = zero;
+    for (int i = 0; i < piece.height; ++i) {
+      hit = hit | (Lanes::Load(&rows_[(y + i)*stride_ + b]) & Lanes::Set(piece.rows[i] << x));
+    }
+    SetBits(hits, b, ~hit.Equal(zero).Bits() & ((1 << Lanes::SIZE) - 1));
+  }
+  // Padding boards past count are empty and never collide, so no bits beyond count are set.
+}
+
+void BoardBatch::ColumnHeights(int* const heights) const {
+  const Lanes one = Lanes::Set(1);
+  uint64_t sums[Lanes::SIZE];
+  for (int b = 0; b < stride_; b += Lanes::SIZE) {
+    // Rows from the top OR'd together, so a column's bit is set in every row at or below its highest block, and
+    // the column height is the number of rows with its bit set.
+    Lanes seen = Lanes::Set(0);
+    for (int y = 0; y < height_; ++y) {
+      seen = seen | Lanes::Load(&rows_[y*stride_ + b]);
+      seen.Store(&scratch_[y*Lanes::SIZE]);
+    }
+    for (int x = 0; x < width_; ++x) {
+      Lanes sum = Lanes::Set(0);
+      for (int y = 0; y < height_; ++y) {
+        sum = sum + ((Lanes::Load(&scratch_[y*Lanes::SIZE]) >> x) & one);
+      }
+      sum.Store(sums);
+      for (int l = 0; l < Lanes::SIZE && b + l < count_; ++l) {
+        heights[x*count_ + b + l] = sums[l];
+      }
+    }
+  }
+}
+
+DropBatch::DropBatch(const int level, const int width, const int height,
+                     const std::vector<PieceGenerator>& generators)
+ : batch_(generators.size(), width, height),
+   hits_((generators.size() + 63) / 64),
+   cleared_(generators.size()) {
+  for (const PieceGenerator& generator : generators) {
+    // As Game's constructor deals the piece it replaces when it adds the first one.
+    State state = {.generator=generator, .piece=0, .next=0, .lines=std::min(45, level * 3), .pieces=0, .over=false};
+    state.generator.Next();
+    state.next = state.generator.Next();
+    games_.push_back(state);
+  }
+  for (std::vector<uint64_t>& group : groups_) {
+    group.resize(hits_.size());
+  }
+  AddPieces(std::vector<uint64_t>(hits_.size(), ~uint64_t{0}));
+}
+
+int DropBatch::Step(const int max_pieces) {
+  std::vector<uint64_t> playing(hits_.size());
+  for (std::vector<uint64_t>& group : groups_) {
+    std::fill(group.begin(), group.end(), 0);
+  }
+  for (int g = 0; g < count(); ++g) {
+    const State& state = games_[g];
+    if (!state.over && (max_pieces == 0 || state.pieces <= max_pieces)) {
+      playing[g / 64] |= uint64_t{1} << (g % 64);
+      groups_[state.piece - 1][g / 64] |= uint64_t{1} << (g % 64);
+    }
+  }
+  // Each piece falls from where it entered until the row below collides, which the floor always does.
+  for (int p = 0; p < NUM_TETROMINOS; ++p) {
+    const PieceMask& mask = orientations.masks[p][0];
+    const int x = batch_.width() / 2 + mask.x;
+    std::vector<uint64_t>& falling = groups_[p];
+    for (int y = mask.y; std::any_of(falling.begin(), falling.end(), [](const uint64_t w) { return w != 0; }); ++y) {
+      batch_.Collides(mask, x, y + 1, hits_.data());
+      for (size_t w = 0; w < falling.size(); ++w) {
+        for (uint64_t landed = falling[w] & hits_[w]; landed; landed &= landed - 1) {
+          const int g = 64*w + __builtin_ctzll(landed);
+          for (int i = 0; i < mask.height; ++i) {
+            batch_.SetRow(g, y + i, batch_.Row(g, y + i) | mask.rows[i] << x);
+          }
+        }
+        falling[w] &= ~hits_[w];
+      }
+    }
+  }
+  batch_.ClearFullRows(cleared_.data());
+  for (int g = 0; g < count(); ++g) {
+    games_[g].lines += cleared_[g];
+  }
+  AddPieces(playing);
+  int still = 0;
+  for (const State& state : games_) {
+    still += !state.over && (max_pieces == 0 || state.pieces <= max_pieces);
+  }
+  return still;
+}
+
+void DropBatch::AddPieces(const std::vector<uint64_t>& playing) {
+  for (std::vector<uint64_t>& group : groups_) {
+    std::fill(group.begin(), group.end(), 0);
+  }
+  for (int g = 0; g < count(); ++g) {
+    if ((playing[g / 64] >> (g % 64)) & 1) {
+      State& state = games_[g];
+      state.piece = state.next;
+      state.next = state.generator.Next();
+      groups_[state.piece - 1][g / 64] |= uint64_t{1} << (g % 64);
+    }
+  }
+  // A game is over when its new piece collides where it enters, as in Game::AddBoardPiece().
+  for (int p = 0; p < NUM_TETROMINOS; ++p) {
+    const PieceMask& mask = orientations.masks[p][0];
+    batch_.Collides(mask, batch_.width() / 2 + mask.x, mask.y, hits_.data());
+    for (size_t w = 0; w < hits_.size(); ++w) {
+      for (uint64_t added = groups_[p][w]; added; added &= added - 1) {
+        const int g = 64*w + __builtin_ctzll(added);
+        if ((hits_[w] >> (g % 64)) & 1) {
+          games_[g].over = true;
+        } else {
+          ++games_[g].pieces;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,107 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Many boards stepped in lockstep, with vectorized kernels over all of them at once.
+
+#ifndef TETRIS_BATCH_H_
+#define TETRIS_BATCH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+#include "generator.h"
+#include "pieces.h"
+
+// Occupancy of many boards of the same size, up to 64 columns wide, in structure-of-arrays layout: row y of every
+// board is stored contiguously, so one vector load reads the same row of several boards. Only occupancy is kept, as
+// the kernels are for evaluating and stepping games, not drawing them.
+//
+// The kernels use AVX2 (4 boards per instruction) or SSE2 (2 boards) when the compiler targets them, and plain
+// 64-bit words otherwise, or when built with TETRIS_BATCH_SCALAR. Results that are one bit per board are written to
+// words of 64 boards each.
+class BoardBatch {
+ public:
+  static const int MAX_WIDTH = 64;
+
+  BoardBatch(int count, int width, int height);
+
+  int count() const { return count_; }
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Name of the instruction set the kernels were compiled for.
+  static const char* InstructionSet();
+
+  uint64_t Row(const int board, const int y) const { return rows_[y*stride_ + board]; }
+  void SetRow(const int board, const int y, const uint64_t bits) { rows_[y*stride_ + board] = bits; }
+  // Copies the occupancy of a board of the same size into the batch.
+  void Load(int board, const Board& source);
+
+  // Sets bit b of full when row y of board b is full.
+  void FullRows(int y, uint64_t* full) const;
+
+  // Removes full rows from every board as Board::ClearFullRows() does, writing the number removed from each board
+  // to lines. Boards are compacted together, one row per board per pass, so the number of passes is the largest
+  // number of rows removed from any one board.
+  void ClearFullRows(int* lines);
+
+  // Sets bit b of hits when the piece collides on board b with its bounding box's top-left corner at (x,y).
+  void Collides(const PieceMask& piece, int x, int y, uint64_t* hits) const;
+
+  // Writes the height of column x of board b, the number of rows from its highest block to the bottom, to
+  // heights[x*count + b].
+  void ColumnHeights(int* heights) const;
+
+ private:
+  const int count_;
+  const int width_;
+  const int height_;
+  // Boards per row, rounded up to a whole number of vectors.
+  const int stride_;
+  const uint64_t full_row_;
+  std::vector<uint64_t> rows_;
+  // Scratch rows of one vector of boards for ColumnHeights().
+  mutable std::vector<uint64_t> scratch_;
+};
+
+// Games of the drop policy played in lockstep on a BoardBatch. Every game drops each piece straight down from where
+// it enters the board, as DropPolicy does, so each ends with the lines and pieces its Game would, without the ticks
+// in between. A step drops the falling piece of every game still playing, with the games that have the same piece
+// searched together by BoardBatch::Collides().
+class DropBatch {
+ public:
+  // One game for each generator, started at level on boards of width by height.
+  DropBatch(int level, int width, int height, const std::vector<PieceGenerator>& generators);
+
+  // Drops, locks and clears for every game still playing, and adds each its next piece. A game stops when a new
+  // piece collides or, unless max_pieces is 0, once it has added more than max_pieces, as the simulator's games do.
+  // Returns the number of games still playing.
+  int Step(int max_pieces);
+
+  int count() const { return batch_.count(); }
+  int lines(const int game) const { return games_[game].lines; }
+  int pieces(const int game) const { return games_[game].pieces; }
+  bool over(const int game) const { return games_[game].over; }
+
+ private:
+  struct State {
+    PieceGenerator generator;
+    int piece;
+    int next;
+    int lines;
+    int pieces;
+    bool over;
+  };
+
+  // Makes the next piece of every game in playing the falling one, ending the games where it collides.
+  void AddPieces(const std::vector<uint64_t>& playing);
+
+  BoardBatch batch_;
+  std::vector<State> games_;
+  // Scratch: one bit per game for each piece, collisions, and the rows each game cleared.
+  std::vector<uint64_t> groups_[NUM_TETROMINOS];
+  std::vector<uint64_t> hits_;
+  std::vector<int> cleared_;
+};
+
+#endif  // TETRIS_BATCH_H_
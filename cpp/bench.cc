@@ -0,0 +1,459 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Microbenchmarks of the game logic hot paths, reporting ns/op over repeated samples.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "batch.h"
+#include "game.h"
+#include "generator.h"
+#include "placement.h"
+#include "versus.h"
+
+struct BenchOptions {
+  // Checks the batch kernels instead of timing anything.
+  bool check = false;
+  int warmup = 3;
+  int samples = 20;
+  // Only benchmarks with names containing the filter are run.
+  std::string filter;
+};
+
+// Keeps the compiler from discarding a result, and from assuming memory is unchanged across the call.
+template <typename T>
+inline void Keep(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Each sample calls setup() untimed, then times op(i) for i in [0, batch). Setup restores any state the ops
+// consume, such as boards with rows to clear, so that every sample measures the same work.
+template <typename Setup, typename Op>
+void Run(const BenchOptions& options, const std::string& name, const int batch, Setup setup, Op op) {
+  if (name.find(options.filter) == std::string::npos) {
+    return;
+  }
+  std::vector<double> ns;
+  for (int sample = 0; sample < options.warmup + options.samples; ++sample) {
+    setup();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < batch; ++i) {
+      op(i);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (sample >= options.warmup) {
+      ns.push_back(std::chrono::duration<double, std::nano>(end - start).count() / batch);
+    }
+  }
+  double mean = 0;
+  for (const double x : ns) {
+    mean += x;
+  }
+  mean /= ns.size();
+  double variance = 0;
+  for (const double x : ns) {
+    variance += (x - mean) * (x - mean);
+  }
+  variance /= std::max<size_t>(ns.size() - 1, 1);
+  const double stddev = std::sqrt(variance);
+  printf("%-28s %10.2f %10.2f %10.2f %8.1f%%\n", name.c_str(), mean, stddev,
+         *std::min_element(ns.begin(), ns.end()), mean > 0 ? 100 * stddev / mean : 0);
+}
+
+void Nothing() {}
+
+// A game whose board has the bottom stack rows filled, full_rows of them completely and the rest with each cell
+// set with probability fill percent but never full. The full rows are spread through the stack. The falling piece
+// is placed just above the stack.
+Game MakeGame(const uint64_t seed, const int stack, const int fill, const int full_rows, const int width=10,
+              const int height=20) {
+  Game game(0, width, height, PieceGenerator(seed));
+  game.AddBoardPiece();
+  Pcg32 random(seed, 2);
+  Board* const board = game.mutable_board();
+  for (int i = 0; i < stack; ++i) {
+    const int y = height - 1 - i;
+    const bool full = i * full_rows / stack != (i + 1) * full_rows / stack;
+    for (int x = 0; x < width; ++x) {
+      const bool set = full || static_cast<int>(random.Below(100)) < fill;
+      board->SetCell(x, y, set ? 1 + random.Below(NUM_TETROMINOS) : 0);
+    }
+    if (!full && board->IsFull(y)) {
+      board->SetCell(random.Below(width), y, 0);
+    }
+  }
+  game.MoveTo(0, width / 2, std::max(0, height - stack - 4));
+  return game;
+}
+
+struct Density {
+  const char* name;
+  int stack;
+  int fill;
+};
+
+const Density DENSITIES[] = {{"sparse", 6, 30}, {"dense", 16, 90}};
+
+// Boards are cycled through so that branch predictors and caches see more than one position.
+const int BOARDS = 64;
+
+void CollisionBenchmarks(const BenchOptions& options) {
+  for (const Density& density : DENSITIES) {
+    std::vector<Game> games;
+    for (int i = 0; i < BOARDS; ++i) {
+      games.push_back(MakeGame(i, density.stack, density.fill, 0));
+    }
+    Run(options, std::string("CollisionDetected/") + density.name, 1 << 20, Nothing, [&](const int i) {
+      Keep(games[i % BOARDS].CollisionDetected(i % 3 - 1, 1));
+    });
+    // The falling piece starts just above the stack.
+    Run(options, std::string("DropDistance/") + density.name, 1 << 20, Nothing, [&](const int i) {
+      Keep(games[i % BOARDS].DropDistance());
+    });
+  }
+}
+
+void MoveBenchmarks(const BenchOptions& options) {
+  Game game = MakeGame(1, 0, 0, 0);
+  Run(options, "MoveTetromino", 1 << 20, Nothing, [&](const int i) {
+    game.MoveTetromino(i & 1 ? -1 : 1, 0);
+    Keep(game);
+  });
+}
+
+void RotateBenchmarks(const BenchOptions& options) {
+  for (const Density& density : DENSITIES) {
+    std::vector<Game> games;
+    for (int i = 0; i < BOARDS; ++i) {
+      games.push_back(MakeGame(i, density.stack, density.fill, 0));
+    }
+    Run(options, std::string("Rotate/") + density.name, 1 << 20, Nothing, [&](const int i) {
+      Keep(games[i % BOARDS].Rotate());
+    });
+  }
+}
+
+void ClearBenchmarks(const BenchOptions& options) {
+  const int batch = 1 << 12;
+  for (const Density& density : DENSITIES) {
+    for (int lines = 0; lines <= 4; ++lines) {
+      std::vector<Game> boards;
+      for (int i = 0; i < BOARDS; ++i) {
+        boards.push_back(MakeGame(i, std::max(density.stack, lines), density.fill, lines));
+      }
+      std::vector<Game> games(batch);
+      auto setup = [&]() {
+        for (int i = 0; i < batch; ++i) {
+          games[i].CopyFrom(boards[i % BOARDS]);
+        }
+      };
+      Run(options, "ClearBoard/" + std::to_string(lines) + "/" + density.name, batch, setup, [&](const int i) {
+        games[i].ClearBoard();
+        Keep(games[i]);
+      });
+    }
+  }
+}
+
+// A board of 1024x4096 for stress tests. Clearing rows costs only the stack, which is the bottom 64 rows, and
+// drawing a window of 10x20 cells of it costs only those cells.
+void GiantBoardBenchmarks(const BenchOptions& options) {
+  const int width = 1024;
+  const int height = 4096;
+  const int batch = 8;
+  const Game board = MakeGame(1, 64, 90, 4, width, height);
+  std::vector<Game> games(batch, board);
+  auto setup = [&]() {
+    for (Game& game : games) {
+      game.CopyFrom(board);
+    }
+  };
+  Run(options, "ClearBoard/4/1024x4096", batch, setup, [&](const int i) {
+    games[i].ClearBoard();
+    Keep(games[i]);
+  });
+  std::vector<uint8_t> cells(10 * 20);
+  Run(options, "Render/10x20/1024x4096", 1 << 16, Nothing, [&](const int i) {
+    board.Render(width / 2 - 5 + i % 8, height - 20, 10, 20, cells.data());
+    Keep(cells);
+  });
+}
+
+// Saving a game to a snapshot, as search and rollback do before each branch.
+void SnapshotBenchmarks(const BenchOptions& options) {
+  std::vector<Game> games;
+  for (int i = 0; i < BOARDS; ++i) {
+    games.push_back(MakeGame(i, DENSITIES[1].stack, DENSITIES[1].fill, 0));
+  }
+  Game snapshot = games[0];
+  Run(options, "Snapshot", 1 << 20, Nothing, [&](const int i) {
+    snapshot.CopyFrom(games[i % BOARDS]);
+    Keep(snapshot);
+  });
+}
+
+// A rollback as RollbackSession::Reconcile() does it: restoring a match part way through and playing depth frames
+// again, with inputs from both players, saving the match after each.
+void RollbackBenchmarks(const BenchOptions& options) {
+  Match start(0, 10, 20, PieceGenerator(1));
+  Pcg32 random(1);
+  while (start.frames() < 600 && !start.IsOver()) {
+    start.Input(start.frames() & 1, static_cast<Game::Input>(random.Below(Game::Input::ROTATE + 1)));
+    start.Tick();
+  }
+  Match match = start;
+  Match saved = start;
+  for (const int depth : {1, 8}) {
+    Run(options, "Rollback/" + std::to_string(depth), 1 << 14, Nothing, [&](const int i) {
+      match.CopyFrom(start);
+      for (int frame = 0; frame < depth; ++frame) {
+        match.Input((i + frame) & 1, static_cast<Game::Input>((i + frame) % (Game::Input::ROTATE + 1)));
+        match.Tick();
+        saved.CopyFrom(match);
+      }
+      Keep(saved);
+    });
+  }
+}
+
+void AddPieceBenchmarks(const BenchOptions& options) {
+  Game game = MakeGame(1, 0, 0, 0);
+  Run(options, "AddBoardPiece", 1 << 20, Nothing, [&](const int i) {
+    game.AddBoardPiece();
+    Keep(game);
+  });
+}
+
+// A whole piece as a player places it: rotate, shift to a column, hard drop, lock, clear rows and add the next
+// piece. Each game places a few pieces from an empty board, so none tops out.
+void HardDropBenchmarks(const BenchOptions& options) {
+  const int games_per_sample = 1 << 9;
+  const int pieces_per_game = 8;
+  std::vector<Game> games;
+  for (int g = 0; g < games_per_sample; ++g) {
+    games.emplace_back(0, 10, 20, PieceGenerator(g));
+    games.back().AddBoardPiece();
+  }
+  const std::vector<Game> saved(games);
+  std::vector<uint8_t> moves(games_per_sample * pieces_per_game);
+  Pcg32 random(1);
+  for (uint8_t& move : moves) {
+    move = random.Below(4) << 4 | random.Below(9);
+  }
+  auto setup = [&]() {
+    for (int g = 0; g < games_per_sample; ++g) {
+      games[g].CopyFrom(saved[g]);
+    }
+  };
+  Run(options, "HardDrop", games_per_sample * pieces_per_game, setup, [&](const int i) {
+    Game& game = games[i / pieces_per_game];
+    const int rotations = moves[i] >> 4;
+    const int shift = (moves[i] & 0xf) - 4;
+    for (int r = 0; r < rotations; ++r) {
+      game.HandleInput(Game::Input::ROTATE);
+    }
+    for (int s = 0; s < std::abs(shift); ++s) {
+      game.HandleInput(shift < 0 ? Game::Input::MOVE_LEFT : Game::Input::MOVE_RIGHT);
+    }
+    game.HandleInput(Game::Input::DROP);
+    game.LockTetromino();
+    game.ClearBoard();
+    game.AddBoardPiece();
+    Keep(game);
+  });
+}
+
+void PlacementBenchmarks(const BenchOptions& options) {
+  for (const Density& density : DENSITIES) {
+    std::vector<Game> games;
+    for (int i = 0; i < BOARDS; ++i) {
+      games.push_back(MakeGame(i, density.stack, density.fill, 0));
+      Game& game = games.back();
+      game.MoveTo(0, game.width() / 2, 0);
+    }
+    PlacementGenerator generator;
+    std::vector<Placement> placements;
+    Run(options, std::string("PlacementGenerator/") + density.name, 1 << 12, Nothing, [&](const int i) {
+      generator.Generate(games[i % BOARDS], &placements);
+      Keep(placements.size());
+    });
+  }
+}
+
+// Drop policy games in lockstep: each op drops a piece in every game of the batch, stepping all of them at once,
+// against the same games stepped one at a time on their own boards. Each sample plays the first few pieces of games
+// just started, before any tops out.
+void LockstepBenchmarks(const BenchOptions& options) {
+  const int count = 1 << 12;
+  const int steps = 8;
+  std::vector<PieceGenerator> generators;
+  for (int g = 0; g < count; ++g) {
+    generators.emplace_back(g);
+  }
+  std::vector<DropBatch> batch;
+  Run(options, "Lockstep/" + std::to_string(count), steps, [&]() {
+    batch.clear();
+    batch.emplace_back(0, 10, 20, generators);
+  }, [&](const int) {
+    Keep(batch[0].Step(0));
+  });
+  std::vector<Game> games;
+  Run(options, "Lockstep/" + std::to_string(count) + "/games", steps, [&]() {
+    games.clear();
+    for (int g = 0; g < count; ++g) {
+      games.emplace_back(0, 10, 20, generators[g]);
+      games.back().AddBoardPiece();
+    }
+  }, [&](const int) {
+    for (Game& game : games) {
+      if (!game.IsGameOver()) {
+        game.HandleInput(Game::Input::DROP);
+        game.LockTetromino();
+        game.ClearBoard();
+        game.AddBoardPiece();
+      }
+      Keep(game);
+    }
+  });
+}
+
+// Compares the batch kernels with the board on random boards of several sizes, with more boards than fit in one word
+// of results so that the padding is covered too. Prints each mismatch and returns whether there were none.
+bool CheckBatch() {
+  const int count = 70;
+  int mismatches = 0;
+  auto mismatch = [&](const char* kernel, const int width, const int height, const int b, const std::string& what) {
+    if (++mismatches <= 10) {
+      printf("%s mismatch on board %d of %dx%d: %s\n", kernel, b, width, height, what.c_str());
+    }
+  };
+  auto bit = [](const std::vector<uint64_t>& bits, const int b) { return (bits[b / 64] >> (b % 64)) & 1; };
+  Pcg32 random(1);
+  for (const int width : {1, 4, 7, 10, 33, 63, 64}) {
+    for (const int height : {1, 4, 20, 37}) {
+      BoardBatch batch(count, width, height);
+      std::vector<Board> boards;
+      for (int b = 0; b < count; ++b) {
+        // A stack of random height whose rows are full a quarter of the time and otherwise random.
+        boards.emplace_back(width, height);
+        Board& board = boards.back();
+        const int stack = random.Below(height + 1);
+        for (int y = height - stack; y < height; ++y) {
+          const bool full = random.Below(4) == 0;
+          for (int x = 0; x < width; ++x) {
+            board.SetCell(x, y, full || random.Below(2) ? 1 + random.Below(NUM_TETROMINOS) : 0);
+          }
+        }
+        batch.Load(b, board);
+      }
+      std::vector<uint64_t> bits((count + 63) / 64);
+      for (int y = 0; y < height; ++y) {
+        batch.FullRows(y, bits.data());
+        for (int b = 0; b < count; ++b) {
+          if (bit(bits, b) != boards[b].IsFull(y)) {
+            mismatch("FullRows", width, height, b, "row " + std::to_string(y));
+          }
+        }
+      }
+      for (int p = 0; p < NUM_TETROMINOS; ++p) {
+        for (int o = 0; o < 4; ++o) {
+          const PieceMask& mask = orientations.masks[p][o];
+          // Every position, and one past each edge.
+          for (int y = -1; y <= height - mask.height + 1; ++y) {
+            for (int x = -1; x <= width - mask.width + 1; ++x) {
+              batch.Collides(mask, x, y, bits.data());
+              for (int b = 0; b < count; ++b) {
+                if (bit(bits, b) != boards[b].Collides(mask, x, y)) {
+                  mismatch("Collides", width, height, b, "piece " + std::to_string(p + 1) + " orientation " +
+                           std::to_string(o) + " at " + std::to_string(x) + "," + std::to_string(y));
+                }
+              }
+            }
+          }
+        }
+      }
+      // Board::ClearFullRows() keeps the column heights up to date with UpdateHeights().
+      std::vector<int> lines(count);
+      batch.ClearFullRows(lines.data());
+      std::vector<int> heights(width * count);
+      batch.ColumnHeights(heights.data());
+      for (int b = 0; b < count; ++b) {
+        Board& board = boards[b];
+        if (lines[b] != board.ClearFullRows()) {
+          mismatch("ClearFullRows", width, height, b, "lines");
+        }
+        for (int y = 0; y < height; ++y) {
+          if (batch.Row(b, y) != board.Row(y)[0]) {
+            mismatch("ClearFullRows", width, height, b, "row " + std::to_string(y));
+          }
+        }
+        for (int x = 0; x < width; ++x) {
+          if (heights[x*count + b] != board.ColumnHeight(x)) {
+            mismatch("ColumnHeights", width, height, b, "column " + std::to_string(x));
+          }
+        }
+      }
+    }
+  }
+  printf("BoardBatch %s: %d mismatches\n", BoardBatch::InstructionSet(), mismatches);
+  return mismatches == 0;
+}
+
+void Usage(const char* const argv0) {
+  std::cerr << "usage: " << argv0 << " [-w warmup samples] [-r samples] [-f filter]\n"
+            << "       " << argv0 << " -c\n\n"
+            << "  -c checks the " << BoardBatch::InstructionSet() << " batch kernels against the board.\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  int opt;
+  while ((opt = getopt(argc, argv, "cw:r:f:")) != -1) {
+    switch (opt) {
+      case 'c':
+        options.check = true;
+        break;
+      case 'w':
+        options.warmup = strtol(optarg, nullptr, 0);
+        break;
+      case 'r':
+        options.samples = strtol(optarg, nullptr, 0);
+        break;
+      case 'f':
+        options.filter = optarg;
+        break;
+      default:
+        Usage(*argv);
+    }
+  }
+  if (options.warmup < 0 || options.samples < 1) {
+    Usage(*argv);
+  }
+  if (options.check) {
+    return CheckBatch() ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  printf("%-28s %10s %10s %10s %9s\n", "benchmark", "ns/op", "stddev", "min", "cv");
+  CollisionBenchmarks(options);
+  MoveBenchmarks(options);
+  RotateBenchmarks(options);
+  ClearBenchmarks(options);
+  GiantBoardBenchmarks(options);
+  SnapshotBenchmarks(options);
+  RollbackBenchmarks(options);
+  AddPieceBenchmarks(options);
+  HardDropBenchmarks(options);
+  PlacementBenchmarks(options);
+  LockstepBenchmarks(options);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,407 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Bitboard representation of the tetris playing field.
+
+#ifndef TETRIS_BOARD_H_
+#define TETRIS_BOARD_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "board_features.h"
+
+// A tetromino as a mask of up to 4 rows, with bit i of a row set for the block i columns right of the bounding
+// box's left edge. (x,y) is the top-left corner of the bounding box in the coordinates it was made from.
+struct PieceMask {
+  uint64_t rows[4];
+  int x;
+  int y;
+  int width;
+  int height;
+  // The rows of the highest and the lowest block in each column of the bounding box.
+  int tops[4];
+  int bottoms[4];
+
+  static constexpr PieceMask FromCoords(const int (* const coords)[2]) {
+    int min_x = coords[0][0], max_x = coords[0][0];
+    int min_y = coords[0][1], max_y = coords[0][1];
+    for (int i = 1; i < 4; ++i) {
+      min_x = std::min(min_x, coords[i][0]);
+      max_x = std::max(max_x, coords[i][0]);
+      min_y = std::min(min_y, coords[i][1]);
+      max_y = std::max(max_y, coords[i][1]);
+    }
+    PieceMask mask = {.rows={0, 0, 0, 0}, .x=min_x, .y=min_y, .width=max_x - min_x + 1, .height=max_y - min_y + 1,
+                      .tops={3, 3, 3, 3}, .bottoms={0, 0, 0, 0}};
+    for (int i = 0; i < 4; ++i) {
+      const int column = coords[i][0] - min_x;
+      const int row = coords[i][1] - min_y;
+      mask.rows[row] |= uint64_t{1} << column;
+      mask.tops[column] = std::min(mask.tops[column], row);
+      mask.bottoms[column] = std::max(mask.bottoms[column], row);
+    }
+    return mask;
+  }
+};
+
+// The board keeps occupancy as bits, 64 columns to a machine word and as many words per row as its width takes, so
+// that collision and full-row checks are a few bitwise operations. A piece is at most 4 columns wide, so it covers
+// one word of each row, or two where it crosses from one word to the next. The color of each cell lives in a
+// separate byte plane that only rendering needs to look at. The board only holds locked blocks; the falling piece
+// is tracked separately by the game.
+//
+// The height of each column, the number of rows from its highest block to the bottom, is kept up to date as
+// blocks are placed and rows cleared, so how far a piece can fall is a few operations per column. So are the
+// features of board_features.h, each change adjusting them for only the rows and words it touched.
+//
+// All of it is kept in one flat allocation made by the constructor, so that search and rollback can save and
+// restore a board with CopyFrom() as often as they like without touching the heap.
+class Board {
+ public:
+  // Boards this wide and this many cells in all, e.g. 4096x16384, are allowed, enough for any stress test while
+  // keeping cell indices in an int.
+  static const int MAX_WIDTH = 4096;
+  static const int MAX_CELLS = 1 << 26;
+
+  // The number of words in each row of a board width columns wide.
+  static constexpr int Words(const int width) { return (width + 63) / 64; }
+
+  Board(const int width, const int height)
+   : width_(width),
+     height_(height),
+     words_(Words(width)),
+     last_word_(width % 64 ? (uint64_t{1} << (width % 64)) - 1 : ~uint64_t{0}),
+     filled_(0),
+     // An empty board is a well only when it is one column wide.
+     features_{.holes=0, .aggregate_height=0, .bumpiness=0, .wells=width == 1 ? height : 0,
+               .row_transitions=2*height, .column_transitions=width} {
+    if (width < 1 || width > MAX_WIDTH || height < 1 || static_cast<long>(width)*height > MAX_CELLS) {
+      std::cerr << "Board: unsupported size " << width << "x" << height << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    storage_.resize(height*words_ + (width*sizeof(int) + 7) / 8 + (width*height + 7) / 8);
+    Point();
+  }
+
+  Board(const Board& other)
+   : width_(other.width_),
+     height_(other.height_),
+     words_(other.words_),
+     last_word_(other.last_word_),
+     storage_(other.storage_),
+     filled_(other.filled_),
+     features_(other.features_) {
+    Point();
+  }
+
+  // Moving the storage keeps its address, so the pointers into it stay valid.
+  Board(Board&& other) = default;
+
+  // Copies the complete state of another board of the same size: one copy of the storage, without allocating.
+  void CopyFrom(const Board& other) {
+    if (other.width_ != width_ || other.height_ != height_) {
+      std::cerr << "Board: cannot copy a " << other.width_ << "x" << other.height_ << " board to a " << width_
+                << "x" << height_ << " board" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    memcpy(storage_.data(), other.storage_.data(), storage_.size() * sizeof(uint64_t));
+    filled_ = other.filled_;
+    features_ = other.features_;
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int words() const { return words_; }
+  // The words() words of row y, bit i of word w set when column 64*w + i is occupied.
+  const uint64_t* Row(const int y) const { return &rows_[y*words_]; }
+  // Word w of a full row.
+  uint64_t FullWord(const int w) const { return w + 1 < words_ ? ~uint64_t{0} : last_word_; }
+  int Color(const int x, const int y) const { return colors_[y*width_ + x]; }
+  // The width() colors of row y.
+  const uint8_t* Colors(const int y) const { return &colors_[y*width_]; }
+  bool Occupied(const int x, const int y) const { return (rows_[y*words_ + (x >> 6)] >> (x & 63)) & 1; }
+  int ColumnHeight(const int x) const { return heights_[x]; }
+  // The row of the highest block, or height() when the board is empty. Every row above it is empty.
+  int Top() const { return height_ - *std::max_element(heights_, heights_ + width_); }
+  const BoardFeatures& features() const { return features_; }
+
+  bool IsFull(const int y) const {
+    const uint64_t* const row = Row(y);
+    for (int w = 0; w + 1 < words_; ++w) {
+      if (row[w] != ~uint64_t{0}) {
+        return false;
+      }
+    }
+    return row[words_ - 1] == last_word_;
+  }
+
+  // Changes between full and empty cells from row y to the row below it, or to the floor below the bottom row, in
+  // words first to last of the rows.
+  int VerticalTransitions(const int y, const int first, const int last) const {
+    const uint64_t* const row = Row(y);
+    int transitions = 0;
+    if (y + 1 < height_) {
+      for (int w = first; w <= last; ++w) {
+        transitions += __builtin_popcountll(row[w] ^ row[w + words_]);
+      }
+    } else {
+      for (int w = first; w <= last; ++w) {
+        transitions += __builtin_popcountll(row[w] ^ FullWord(w));
+      }
+    }
+    return transitions;
+  }
+
+  int VerticalTransitions(const int y) const { return VerticalTransitions(y, 0, words_ - 1); }
+
+  // Sets one cell to a color, or empties it with color 0.
+  void SetCell(const int x, const int y, const int color) {
+    const int w = x >> 6;
+    const uint64_t bit = uint64_t{1} << (x & 63);
+    const uint64_t word = color ? Row(y)[w] | bit : Row(y)[w] & ~bit;
+    SetWords(y, 1, w, 1, &word);
+    colors_[y*width_ + x] = color;
+    int height = heights_[x];
+    if (color) {
+      height = std::max(height, height_ - y);
+    } else if (height == height_ - y) {
+      // The highest block was removed, so the column is as high as the next block down.
+      int below = y + 1;
+      while (below < height_ && !Occupied(x, below)) {
+        ++below;
+      }
+      height = height_ - below;
+    }
+    SetHeights(x, 1, &height);
+  }
+
+  // Collision is hitting the left wall, right wall, top, bottom, or an occupied cell when the piece's bounding box
+  // is placed with its top-left corner at (x,y).
+  bool Collides(const PieceMask& piece, const int x, const int y) const {
+    if (x < 0 || x + piece.width > width_ || y < 0 || y + piece.height > height_) {
+      return true;
+    }
+    const int shift = x & 63;
+    const uint64_t* row = &rows_[y*words_ + (x >> 6)];
+    uint64_t hit = 0;
+    for (int i = 0; i < piece.height; ++i, row += words_) {
+      hit |= row[0] & (piece.rows[i] << shift);
+      if (shift + piece.width > 64) {
+        hit |= row[1] & (piece.rows[i] >> (64 - shift));
+      }
+    }
+    return hit != 0;
+  }
+
+  // The number of rows a piece that fits with the top-left corner of its bounding box at (x,y) can fall before it
+  // lands. When the lowest block of every column of the piece is above that column's highest block, everything
+  // between them is empty, so the distance is the smallest gap. A piece tucked under an overhang falls row by row.
+  int DropDistance(const PieceMask& piece, const int x, const int y) const {
+    int distance = height_;
+    for (int i = 0; i < piece.width; ++i) {
+      const int gap = height_ - heights_[x + i] - (y + piece.bottoms[i]) - 1;
+      if (gap < 0) {
+        distance = 0;
+        while (!Collides(piece, x, y + distance + 1)) {
+          ++distance;
+        }
+        return distance;
+      }
+      distance = std::min(distance, gap);
+    }
+    return distance;
+  }
+
+  // Writes the piece into the board with the top-left corner of its bounding box at (x,y) and the given color.
+  void Place(const PieceMask& piece, const int x, const int y, const int color) {
+    const int word = x >> 6;
+    const int shift = x & 63;
+    const int count = shift + piece.width > 64 ? 2 : 1;
+    uint64_t words[8] = {};
+    for (int i = 0; i < piece.height; ++i) {
+      const uint64_t* const row = Row(y + i) + word;
+      uint8_t* const row_colors = &colors_[(y + i)*width_ + 64*word];
+      for (int k = 0; k < count; ++k) {
+        const uint64_t bits = k ? piece.rows[i] >> (64 - shift) : piece.rows[i] << shift;
+        words[i*count + k] = row[k] | bits;
+        for (uint64_t b = bits; b; b &= b - 1) {
+          row_colors[64*k + __builtin_ctzll(b)] = color;
+        }
+      }
+    }
+    SetWords(y, piece.height, word, count, words);
+    int heights[4] = {};
+    for (int i = 0; i < piece.width; ++i) {
+      heights[i] = std::max(heights_[x + i], height_ - (y + piece.tops[i]));
+    }
+    SetHeights(x, piece.width, heights);
+  }
+
+  // Removes completed (filled) rows, moving the remaining rows down and clearing rows at the top. Full rows can only
+  // be among the rows with blocks, so only those are looked at, and the rows from the lowest full row up are moved
+  // in a single pass. The cost grows with the height of the stack, not with the height of the board or the number of
+  // rows removed. Returns the number of rows removed.
+  int ClearFullRows() {
+    const int top = Top();
+    int lowest = height_ - 1;
+    while (lowest >= top && !IsFull(lowest)) {
+      --lowest;
+    }
+    if (lowest < top) {
+      return 0;
+    }
+    // Only the vertical transitions from the row above the stack down to the lowest full row change.
+    const int above = std::max(top - 1, 0);
+    for (int y = above; y <= lowest; ++y) {
+      features_.column_transitions -= VerticalTransitions(y);
+    }
+    int write = lowest;
+    int first_full = lowest;
+    for (int read = lowest; read >= top; --read) {
+      if (IsFull(read)) {
+        first_full = read;
+        continue;
+      }
+      if (write != read) {
+        for (int w = 0; w < words_; ++w) {
+          rows_[write*words_ + w] = rows_[read*words_ + w];
+        }
+        memcpy(&colors_[write*width_], &colors_[read*width_], width_);
+      }
+      --write;
+    }
+    const int rows_deleted = write - top + 1;
+    memset(&rows_[top*words_], 0, rows_deleted * words_ * sizeof(uint64_t));
+    memset(&colors_[top*width_], 0, rows_deleted * width_);
+    // The rows cleared at the top are empty and have none between them.
+    for (int y = std::max(top + rows_deleted - 1, 0); y <= lowest; ++y) {
+      features_.column_transitions += VerticalTransitions(y);
+    }
+    // A full row has no row transitions, and an empty row at the top has 2.
+    features_.row_transitions += 2*rows_deleted;
+    filled_ -= rows_deleted*width_;
+    UpdateHeights(first_full, rows_deleted);
+    return rows_deleted;
+  }
+
+ private:
+  // Replaces words word to word + count_words - 1 of count rows from row y, given row by row, adjusting the
+  // features for them and the rows and words beside them.
+  void SetWords(const int y, const int count, const int word, const int count_words, const uint64_t* const words) {
+    const int above = std::max(y - 1, 0);
+    const int last = y + count - 1;
+    const int last_word = word + count_words - 1;
+    // The row transitions of a word include the one into the next word, so the word before changes too.
+    const int first_word = std::max(word - 1, 0);
+    for (int r = above; r <= last; ++r) {
+      features_.column_transitions -= VerticalTransitions(r, word, last_word);
+    }
+    for (int i = 0; i < count; ++i) {
+      uint64_t* const row = &rows_[(y + i)*words_];
+      features_.row_transitions -= RowTransitions(row + first_word, first_word, last_word, words_, width_);
+      for (int k = 0; k < count_words; ++k) {
+        filled_ += __builtin_popcountll(words[i*count_words + k]) - __builtin_popcountll(row[word + k]);
+        row[word + k] = words[i*count_words + k];
+      }
+      features_.row_transitions += RowTransitions(row + first_word, first_word, last_word, words_, width_);
+    }
+    for (int r = above; r <= last; ++r) {
+      features_.column_transitions += VerticalTransitions(r, word, last_word);
+    }
+    features_.holes = features_.aggregate_height - filled_;
+  }
+
+  // The height of a column, or of a wall for the columns beside the board.
+  int HeightOrWall(const int x) const { return x < 0 || x >= width_ ? height_ : heights_[x]; }
+
+  // Adds sign times the bumpiness and well depths that depend on the heights of columns first to last.
+  void AddHeightFeatures(const int first, const int last, const int sign) {
+    for (int c = std::max(first - 1, 0); c <= std::min(last + 1, width_ - 1); ++c) {
+      if (c <= last && c + 1 < width_) {
+        features_.bumpiness += sign*std::abs(heights_[c] - heights_[c + 1]);
+      }
+      features_.wells += sign*WellDepth(HeightOrWall(c - 1), heights_[c], HeightOrWall(c + 1));
+    }
+  }
+
+  // Replaces the heights of count columns from column x, adjusting the features for them and their neighbors.
+  void SetHeights(const int x, const int count, const int* const heights) {
+    AddHeightFeatures(x, x + count - 1, -1);
+    for (int i = 0; i < count; ++i) {
+      features_.aggregate_height += heights[i] - heights_[x + i];
+      heights_[x + i] = heights[i];
+    }
+    AddHeightFeatures(x, x + count - 1, 1);
+    features_.holes = features_.aggregate_height - filled_;
+  }
+
+  // Updates the column heights after rows_deleted full rows, the highest of them row first_full, were removed.
+  // Every column had a block in each of them, so a column whose highest block was above first_full is just lower by
+  // rows_deleted. The highest block of the others was removed, so their next blocks down are found by scanning
+  // the rows below, a word of columns at a time.
+  void UpdateHeights(const int first_full, const int rows_deleted) {
+    for (int w = 0; w < words_; ++w) {
+      const int first = 64*w;
+      const int end = std::min(first + 64, width_);
+      uint64_t unknown = 0;
+      for (int x = first; x < end; ++x) {
+        if (height_ - heights_[x] < first_full) {
+          heights_[x] -= rows_deleted;
+        } else {
+          unknown |= uint64_t{1} << (x - first);
+        }
+      }
+      for (int y = first_full + rows_deleted; y < height_ && unknown; ++y) {
+        const uint64_t row = rows_[y*words_ + w];
+        for (uint64_t found = row & unknown; found; found &= found - 1) {
+          heights_[first + __builtin_ctzll(found)] = height_ - y;
+        }
+        unknown &= ~row;
+      }
+      for (; unknown; unknown &= unknown - 1) {
+        heights_[first + __builtin_ctzll(unknown)] = 0;
+      }
+    }
+
+    // Every height changed, so the features of the heights are summed again in one pass.
+    features_.aggregate_height = 0;
+    features_.bumpiness = 0;
+    features_.wells = 0;
+    for (int x = 0; x < width_; ++x) {
+      features_.aggregate_height += heights_[x];
+      if (x > 0) {
+        features_.bumpiness += std::abs(heights_[x - 1] - heights_[x]);
+      }
+      features_.wells += WellDepth(HeightOrWall(x - 1), heights_[x], HeightOrWall(x + 1));
+    }
+    features_.holes = features_.aggregate_height - filled_;
+  }
+
+  // Points rows_, heights_ and colors_ into the storage.
+  void Point() {
+    rows_ = storage_.data();
+    heights_ = reinterpret_cast<int*>(rows_ + height_*words_);
+    colors_ = reinterpret_cast<uint8_t*>(rows_ + height_*words_ + (width_*sizeof(int) + 7) / 8);
+  }
+
+  const int width_;
+  const int height_;
+  const int words_;
+  // The bits of the last word of each row that are columns of the board.
+  const uint64_t last_word_;
+  // The rows, then the column heights, then the colors.
+  std::vector<uint64_t> storage_;
+  uint64_t* rows_;
+  int* heights_;
+  uint8_t* colors_;
+  // The number of full cells.
+  int filled_;
+  BoardFeatures features_;
+};
+
+#endif  // TETRIS_BOARD_H_
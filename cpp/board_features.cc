@@ -0,0 +1,172 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// The board features that placement-evaluating policies score positions by.
+
+#include "board_features.h"
+
+#include <cstdlib>
+
+#include "board.h"
+
+namespace {
+
+// ComputeFeatures() for rows of WORDS words, or of any number for 0, so that the loops over the words of a row of
+// a board of up to 64 columns are unrolled.
+template <int WORDS>
+BoardFeatures ComputeFeaturesWords(const uint64_t* const rows, const int width, const int height) {
+  const int words = WORDS ? WORDS : Board::Words(width);
+  auto full_word = [&](const int w) { return w + 1 < words ? ~uint64_t{0} : ~uint64_t{0} >> (64*words - width); };
+  BoardFeatures features = {};
+  int filled = 0;
+  for (int y = 0; y < height; ++y) {
+    const uint64_t* const row = &rows[y*words];
+    features.row_transitions += RowTransitions(row, 0, words - 1, words, width);
+    for (int w = 0; w < words; ++w) {
+      filled += __builtin_popcountll(row[w]);
+      features.column_transitions += __builtin_popcountll(row[w] ^ (y + 1 < height ? row[w + words] : full_word(w)));
+    }
+  }
+  // Column heights are found a word of columns at a time, and a column's well is added once the height of the
+  // column right of it is known. left and middle are the heights of the two columns before it.
+  int left = height;
+  int middle = -1;
+  auto add_column = [&](const int column_height) {
+    features.aggregate_height += column_height;
+    if (middle >= 0) {
+      features.bumpiness += std::abs(middle - column_height);
+      features.wells += WellDepth(left, middle, column_height);
+      left = middle;
+    }
+    middle = column_height;
+  };
+  for (int w = 0; w < words; ++w) {
+    const int columns = std::min(width - 64*w, 64);
+    int heights[64] = {};
+    // Columns whose highest block has not been found yet, scanning down.
+    uint64_t unknown = full_word(w);
+    for (int y = 0; y < height && unknown; ++y) {
+      const uint64_t row = rows[y*words + w];
+      for (uint64_t found = row & unknown; found; found &= found - 1) {
+        heights[__builtin_ctzll(found)] = height - y;
+      }
+      unknown &= ~row;
+    }
+    for (int i = 0; i < columns; ++i) {
+      add_column(heights[i]);
+    }
+  }
+  features.wells += WellDepth(left, middle, height);
+  features.holes = features.aggregate_height - filled;
+  return features;
+}
+
+}  // namespace
+
+BoardFeatures ComputeFeatures(const uint64_t* const rows, const int width, const int height) {
+  return width <= 64 ? ComputeFeaturesWords<1>(rows, width, height) : ComputeFeaturesWords<0>(rows, width, height);
+}
+
+BoardFeatures FeatureEvaluator::AfterLock(const Board& board, const PieceMask& piece, const int x, const int y,
+                                          int* const lines) {
+  if (board.words() == 1) {
+    return AfterLockWords<1>(board, piece, x, y, lines);
+  }
+  return AfterLockWords<0>(board, piece, x, y, lines);
+}
+
+template <int WORDS>
+BoardFeatures FeatureEvaluator::AfterLockWords(const Board& board, const PieceMask& piece, const int x, const int y,
+                                               int* const lines) {
+  const int width = board.width();
+  const int height = board.height();
+  const int words = WORDS ? WORDS : board.words();
+  const int word = WORDS == 1 ? 0 : x >> 6;
+  const int shift = x & 63;
+  const int last = WORDS != 1 && shift + piece.width > 64 ? word + 1 : word;
+  // Words first to end - 1 of each row the piece covers, with the piece locked: the words it covers and one more on
+  // either side, for the row transitions between them.
+  const int first = std::max(word - 1, 0);
+  const int end = std::min(last + 2, words);
+  uint64_t rows[4][4];
+  int blocks = 0;
+  *lines = 0;
+  for (int i = 0; i < piece.height; ++i) {
+    const uint64_t* const row = board.Row(y + i);
+    std::copy(row + first, row + end, rows[i]);
+    rows[i][word - first] |= piece.rows[i] << shift;
+    if (last != word) {
+      rows[i][last - first] |= piece.rows[i] >> (64 - shift);
+    }
+    blocks += __builtin_popcountll(piece.rows[i]);
+    bool full = true;
+    for (int w = 0; w < words && full; ++w) {
+      full = (w >= first && w < end ? rows[i][w - first] : row[w]) == board.FullWord(w);
+    }
+    *lines += full;
+  }
+  // Word w of row r after locking the piece, for w from first to end - 1.
+  auto word_after = [&](const int r, const int w) {
+    return r >= y && r < y + piece.height ? rows[r - y][w - first] : board.Row(r)[w];
+  };
+
+  if (*lines) {
+    // The board after locking the piece, with full rows removed.
+    rows_.resize(height*words);
+    int write = height - 1;
+    for (int read = height - 1; read >= 0; --read) {
+      bool full = true;
+      for (int w = 0; w < words; ++w) {
+        rows_[write*words + w] = w >= first && w < end ? word_after(read, w) : board.Row(read)[w];
+        full &= rows_[write*words + w] == board.FullWord(w);
+      }
+      if (!full) {
+        --write;
+      }
+    }
+    std::fill(rows_.begin(), rows_.begin() + (write + 1)*words, 0);
+    return ComputeFeaturesWords<WORDS>(rows_.data(), width, height);
+  }
+
+  BoardFeatures features = board.features();
+  features.holes -= blocks;
+  for (int i = 0; i < piece.height; ++i) {
+    features.row_transitions += RowTransitions(rows[i], first, last, words, width) -
+                                RowTransitions(board.Row(y + i) + first, first, last, words, width);
+  }
+  // The vertical transitions change between the row above the piece and the row below it, in the words it covers.
+  for (int r = std::max(y - 1, 0); r < y + piece.height; ++r) {
+    for (int w = word; w <= last; ++w) {
+      features.column_transitions += __builtin_popcountll(word_after(r, w) ^
+                                                          (r + 1 < height ? word_after(r + 1, w) : board.FullWord(w)));
+    }
+    features.column_transitions -= board.VerticalTransitions(r, word, last);
+  }
+  // Heights of the piece's columns and two more on either side, as the wells beside the piece depend on them.
+  // Index i is column x - 2 + i.
+  const int columns = piece.width + 4;
+  int before[8];
+  int after[8];
+  for (int i = 0; i < columns; ++i) {
+    const int c = x - 2 + i;
+    before[i] = c < 0 || c >= width ? height : board.ColumnHeight(c);
+    after[i] = before[i];
+  }
+  for (int c = 0; c < piece.width; ++c) {
+    after[c + 2] = std::max(before[c + 2], height - (y + piece.tops[c]));
+    features.aggregate_height += after[c + 2] - before[c + 2];
+    features.holes += after[c + 2] - before[c + 2];
+  }
+  for (int i = 1; i < columns - 1; ++i) {
+    const int c = x - 2 + i;
+    if (c < 0 || c >= width) {
+      continue;
+    }
+    features.wells += WellDepth(after[i - 1], after[i], after[i + 1]) -
+                      WellDepth(before[i - 1], before[i], before[i + 1]);
+    if (c + 1 < width && i + 1 < columns - 1) {
+      features.bumpiness += std::abs(after[i] - after[i + 1]) - std::abs(before[i] - before[i + 1]);
+    }
+  }
+  return features;
+}
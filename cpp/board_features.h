@@ -0,0 +1,78 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// The board features that placement-evaluating policies score positions by.
+
+#ifndef TETRIS_BOARD_FEATURES_H_
+#define TETRIS_BOARD_FEATURES_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class Board;
+struct PieceMask;
+
+// Heights are the number of rows from a column's highest block to the bottom. The walls and the floor count as
+// full cells, and as columns of the board's height.
+struct BoardFeatures {
+  // Empty cells below the highest block of their column.
+  int holes;
+  // The sum of the column heights.
+  int aggregate_height;
+  // The sum of the height differences between adjacent columns.
+  int bumpiness;
+  // The sum of the well depths: how far each column is below the lower of its neighbors.
+  int wells;
+  // Changes between full and empty cells along each row, counting the walls, so an empty row has 2.
+  int row_transitions;
+  // Changes between full and empty cells down each column, counting the floor.
+  int column_transitions;
+};
+
+// Changes between full and empty cells along words first to last of a row of words words, width columns wide, given
+// as the words from word first on. Each word counts the change into the next word, and the walls count at either
+// end of the row, so summed over every word this is the row's transitions, and changing words first + 1 to last
+// changes only the transitions of words first to last.
+inline int RowTransitions(const uint64_t* const row, const int first, const int last, const int words,
+                          const int width) {
+  int transitions = 0;
+  for (int w = first; w <= last; ++w) {
+    const uint64_t bits = row[w - first];
+    const int columns = w + 1 < words ? 64 : width - 64*w;
+    const uint64_t inside = columns == 64 ? ~uint64_t{0} >> 1 : (uint64_t{1} << (columns - 1)) - 1;
+    transitions += __builtin_popcountll((bits ^ (bits >> 1)) & inside);
+    if (w == 0) {
+      transitions += !(bits & 1);
+    }
+    transitions += w + 1 < words ? ((bits >> 63) ^ row[w + 1 - first]) & 1 : !((bits >> (columns - 1)) & 1);
+  }
+  return transitions;
+}
+
+inline int WellDepth(const int left, const int height, const int right) {
+  return std::max(std::min(left, right) - height, 0);
+}
+
+// Measures a board given as rows of occupancy bits, as many words each as Board::Words(width), from scratch.
+BoardFeatures ComputeFeatures(const uint64_t* rows, int width, int height);
+
+// Finds the features a board would have after locking a piece and removing the rows it completes, for scoring
+// candidate placements without changing the board. Only rows the piece covers can be completed. When it completes
+// none, the result is the board's own features, which the board keeps up to date, adjusted for the at most 4 rows
+// and the columns the piece covers and their neighbors. A placement that completes rows shifts the whole board, so
+// the board after it is built in a buffer the evaluator keeps and measured from scratch.
+class FeatureEvaluator {
+ public:
+  // piece fits with the top-left corner of its bounding box at (x,y). Sets lines to the number of rows completed.
+  BoardFeatures AfterLock(const Board& board, const PieceMask& piece, int x, int y, int* lines);
+
+ private:
+  // AfterLock() for rows of WORDS words, or of any number for 0.
+  template <int WORDS>
+  BoardFeatures AfterLockWords(const Board& board, const PieceMask& piece, int x, int y, int* lines);
+
+  std::vector<uint64_t> rows_;
+};
+
+#endif  // TETRIS_BOARD_FEATURES_H_
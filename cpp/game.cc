@@ -0,0 +1,233 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// The rules of the tetris game.
+
+#include "game.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include "varint.h"
+
+Game::Game(const int level, const int width, const int height, const PieceGenerator& generator)
+ : generator_(generator),
+   board_(width, height),
+   current_x_(0),
+   current_y_(0),
+   completed_lines_(std::min(45, level * 3)),
+   status_(Status::PLAY),
+   game_ticks_(0),
+   drop_ticks_(0),
+   pieces_(0) {
+  current_orientation_ = 0;
+  current_piece_ = generator_.Next();
+  next_piece_ = generator_.Next();
+}
+
+void Game::AddBoardPiece() {
+  PROFILE_SCOPE("AddBoardPiece");
+  current_orientation_ = 0;
+  current_piece_ = next_piece_;
+  next_piece_ = generator_.Next();
+  const PieceMask& mask = orientations.masks[current_piece_-1][0];
+  const int x = board_.width() / 2;
+  if (board_.Collides(mask, x + mask.x, mask.y)) {
+    status_ = Status::GAMEOVER;
+  } else {
+    current_x_ = x;
+    current_y_ = 0;
+    ++pieces_;
+  }
+}
+
+void Game::CurrentCoords(Coords coords) const {
+  const int (* const shape)[2] = orientations.shapes[current_piece_-1][current_orientation_];
+  for (int i = 0; i < 4; ++i) {
+    coords[i][0] = current_x_ + shape[i][0];
+    coords[i][1] = current_y_ + shape[i][1];
+  }
+}
+
+void Game::Render(const int left, const int top, const int columns, const int rows, uint8_t* const cells) const {
+  for (int y = 0; y < rows; ++y) {
+    for (int x = 0; x < columns; ++x) {
+      cells[y*columns + x] = board_.Color(left + x, top + y);
+    }
+  }
+  // The falling piece is not part of the board, so it is drawn over it, and over its ghost where they overlap.
+  if (IsGameOver()) {
+    return;
+  }
+  Coords coords;
+  CurrentCoords(coords);
+  auto shown = [&](const int x, const int y) { return x >= left && x < left + columns && y >= top && y < top + rows; };
+  const int drop = DropDistance();
+  for (const auto& [x, y] : coords) {
+    if (shown(x, y + drop)) {
+      cells[(y + drop - top)*columns + x - left] = GHOST | current_piece_;
+    }
+  }
+  for (const auto& [x, y] : coords) {
+    if (shown(x, y)) {
+      cells[(y - top)*columns + x - left] = current_piece_;
+    }
+  }
+}
+
+void Game::Serialize(std::vector<uint8_t>* const out) const {
+  PutVarint(out, current_piece_);
+  PutVarint(out, current_orientation_);
+  PutVarint(out, ZigZag(current_x_));
+  PutVarint(out, ZigZag(current_y_));
+  PutVarint(out, next_piece_);
+  PutVarint(out, completed_lines_);
+  PutVarint(out, status_);
+  PutVarint(out, game_ticks_);
+  PutVarint(out, drop_ticks_);
+  PutVarint(out, pieces_);
+  generator_.Serialize(out);
+  // Only the rows from the top of the stack down are written, so the state of a big board is as big as its stack.
+  // Colors fit in 4 bits, so two cells are packed per byte.
+  const int top = board_.Top();
+  PutVarint(out, top);
+  const uint8_t* const colors = board_.Colors(top);
+  const int cells = (height() - top) * width();
+  for (int i = 0; i < cells; i += 2) {
+    out->push_back(colors[i] | (i + 1 < cells ? colors[i + 1] << 4 : 0));
+  }
+}
+
+bool Game::Deserialize(const uint8_t* data, const size_t size) {
+  const uint8_t* const end = data + size;
+  uint64_t values[10];
+  for (uint64_t& value : values) {
+    if (!GetVarint(&data, end, &value)) {
+      return false;
+    }
+  }
+  // Everything is decoded and checked before any of it is kept, so a rejected state leaves the game as it was.
+  PieceGenerator generator = generator_;
+  uint64_t top;
+  if (values[0] < 1 || values[0] > NUM_TETROMINOS || values[1] > 3 || values[4] < 1 || values[4] > NUM_TETROMINOS ||
+      values[5] > INT_MAX || values[6] > Status::GAMEOVER || values[9] > INT_MAX ||
+      !generator.Deserialize(&data, end) || !GetVarint(&data, end, &top) ||
+      top > static_cast<uint64_t>(height()) || end - data != ((height() - static_cast<int>(top)) * width() + 1) / 2) {
+    return false;
+  }
+  const int first = top;
+  const int cells = (height() - first) * width();
+  // The rows above the first written are empty.
+  const auto color_at = [data, first, this](const int x, const int y) {
+    const int i = (y - first) * width() + x;
+    return i < 0 ? 0 : (data[i / 2] >> (i % 2 * 4)) & 0xf;
+  };
+  for (int i = 0; i < cells; ++i) {
+    if (((data[i / 2] >> (i % 2 * 4)) & 0xf) > NUM_TETROMINOS) {
+      return false;
+    }
+  }
+  const int64_t piece_x = UnZigZag(values[2]);
+  const int64_t piece_y = UnZigZag(values[3]);
+  // A piece in play lies on the board, over empty cells. At game over it is the piece that did not fit, left at the
+  // last piece's position, so only that position is checked, to within the size of a piece.
+  if (values[6] != Status::GAMEOVER) {
+    const int (* const shape)[2] = orientations.shapes[values[0]-1][values[1]];
+    for (int i = 0; i < 4; ++i) {
+      const int64_t cell_x = piece_x + shape[i][0];
+      const int64_t cell_y = piece_y + shape[i][1];
+      if (cell_x < 0 || cell_x >= width() || cell_y < 0 || cell_y >= height() || color_at(cell_x, cell_y) != 0) {
+        return false;
+      }
+    }
+  } else if (piece_x < -4 || piece_x >= width() + 4 || piece_y < -4 || piece_y >= height() + 4) {
+    return false;
+  }
+  current_piece_ = values[0];
+  current_orientation_ = values[1];
+  current_x_ = piece_x;
+  current_y_ = piece_y;
+  next_piece_ = values[4];
+  completed_lines_ = values[5];
+  status_ = static_cast<Status>(values[6]);
+  game_ticks_ = values[7];
+  drop_ticks_ = values[8];
+  pieces_ = values[9];
+  generator_ = generator;
+  // Only the rows of the old stack or the new one have blocks to set or clear.
+  for (int y = std::min(board_.Top(), first); y < height(); ++y) {
+    for (int x = 0; x < width(); ++x) {
+      board_.SetCell(x, y, color_at(x, y));
+    }
+  }
+  return true;
+}
+
+void Game::Pause() {
+  switch (status_) {
+    case PLAY:
+      status_ = PAUSE;
+      break;
+    case PAUSE:
+      status_ = PLAY;
+      break;
+    default:
+      break;
+  }
+}
+
+bool Game::HandleInput(const Input input) {
+  if (!IsInPlay()) {
+    return false;
+  }
+  bool changed = false;
+  switch (input) {
+    case MOVE_LEFT:
+      if (!CollisionDetected(-1, 0)) {
+        changed = true;
+        MoveTetromino(-1, 0);
+      }
+      break;
+    case MOVE_RIGHT:
+      if (!CollisionDetected(1, 0)) {
+        changed = true;
+        MoveTetromino(1, 0);
+      }
+      break;
+    case MOVE_DOWN:
+      if (!CollisionDetected(0, 1)) {
+        changed = true;
+        MoveTetromino(0, 1);
+      }
+      break;
+    case DROP: {
+      const int distance = DropDistance();
+      changed = distance > 0;
+      MoveTetromino(0, distance);
+      break;
+    }
+    case ROTATE:
+      changed = Rotate();
+      break;
+  }
+  return changed;
+}
+
+bool Game::Tick() {
+  PROFILE_SCOPE("Tick");
+  ++game_ticks_;
+  if (!IsInPlay() || !DropCheck()) {
+    return false;
+  }
+  const int distance = DropDistance();
+  if (distance > 0) {
+    MoveTetromino(0, std::min(distance, GravityRows()));
+  } else {
+    LockTetromino();
+    ClearBoard();
+    AddBoardPiece();
+  }
+  return true;
+}
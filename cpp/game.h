@@ -0,0 +1,181 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// The rules of the tetris game, independent of any display, audio or input device.
+
+#ifndef TETRIS_GAME_H_
+#define TETRIS_GAME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+#include "generator.h"
+#include "pieces.h"
+#include "profile.h"
+
+// The complete state of one game: the board, the falling and next pieces, completed lines and tick counters.
+// Pieces are numbered 1 to NUM_TETROMINOS, with 0 used for an empty cell.
+class Game {
+ public:
+  enum Status {PLAY, PAUSE, GAMEOVER};
+
+  // Player actions on the falling piece.
+  enum Input {MOVE_LEFT, MOVE_RIGHT, MOVE_DOWN, DROP, ROTATE};
+
+  // Games constructed with equal generators are dealt the same sequence of pieces.
+  Game(const int level=0, const int width=10, const int height=20, const PieceGenerator& generator=PieceGenerator());
+
+  // Sets the game over condition if adding a new piece collides. Checks game-over before adding piece to the board
+  // so the final piece is not written to the screen with a collision.
+  void AddBoardPiece();
+
+  // Writes the current piece into the board once it can no longer move down.
+  void LockTetromino() {
+    const PieceMask& mask = current_mask();
+    board_.Place(mask, current_x_ + mask.x, current_y_ + mask.y, current_piece_);
+  }
+
+  bool CollisionDetected(const int dx, const int dy) const {
+    PROFILE_SCOPE("CollisionDetected");
+    // The board only holds locked blocks, so the piece cannot collide with itself.
+    const PieceMask& mask = current_mask();
+    return board_.Collides(mask, current_x_ + mask.x + dx, current_y_ + mask.y + dy);
+  }
+
+  // Rows the falling piece can move down before it lands.
+  int DropDistance() const {
+    const PieceMask& mask = current_mask();
+    return board_.DropDistance(mask, current_x_ + mask.x, current_y_ + mask.y);
+  }
+
+  void MoveTetromino(const int dx, const int dy) {
+    current_x_ += dx;
+    current_y_ += dy;
+  }
+
+  // Clear completed (filled) rows.
+  void ClearBoard() {
+    PROFILE_SCOPE("ClearBoard");
+    completed_lines_ += board_.ClearFullRows();
+  }
+
+  // Rotates to the next orientation unless the rotated piece collides.
+  bool Rotate() {
+    const int orientation = (current_orientation_ + 1) % 4;
+    const PieceMask& mask = orientations.masks[current_piece_-1][orientation];
+    if (board_.Collides(mask, current_x_ + mask.x, current_y_ + mask.y)) {
+      return false;
+    }
+    current_orientation_ = orientation;
+    return true;
+  }
+
+  // Moves the falling piece straight to an orientation and origin without checking the path there. The position
+  // must be free, such as one found by a PlacementGenerator.
+  void MoveTo(const int orientation, const int x, const int y) {
+    current_orientation_ = orientation;
+    current_x_ = x;
+    current_y_ = y;
+  }
+
+  bool DropCheck() {
+    PROFILE_SCOPE("DropCheck");
+    if (game_ticks_ >= drop_ticks_ + std::max(15 - completed_lines_ / 3, 1)) {
+      drop_ticks_ = game_ticks_;
+      return true;
+    }
+    return false;
+  }
+
+  // Rows the piece falls on each drop. DropCheck() drops every tick from level 14, so each level after that adds a
+  // row: 2 at level 15, 3 at level 16.
+  int GravityRows() const { return std::max(level() - 13, 1); }
+
+  void Pause();
+
+  // Applies a player input to the falling piece while in play. Returns whether the piece moved.
+  bool HandleInput(Input input);
+
+  // Advances the game clock by one tick, moving the piece down GravityRows() when the drop interval has elapsed, or
+  // locking it and adding the next piece when it cannot move down. Returns whether the board changed.
+  bool Tick();
+
+  // Or'd with the color of the falling piece in the cells Render() shows its ghost in.
+  static const uint8_t GHOST = 8;
+
+  // Fills cells, row by row, with the color of every cell of the board and the falling piece drawn over it. The
+  // cells where a hard drop would land the piece, and it does not cover, are its ghost.
+  void Render(uint8_t* const cells) const { Render(0, 0, width(), height(), cells); }
+
+  // Render() of only the columns by rows cells from (left,top), which must be on the board, so that drawing part of
+  // a large board costs only the cells drawn.
+  void Render(int left, int top, int columns, int rows, uint8_t* cells) const;
+
+  // Copies the complete state of another game with a board of the same size, without allocating. A copy of a game
+  // made once is a snapshot that search and rollback can save to and restore from with this, as often as they like.
+  void CopyFrom(const Game& other) {
+    generator_ = other.generator_;
+    board_.CopyFrom(other.board_);
+    current_piece_ = other.current_piece_;
+    current_orientation_ = other.current_orientation_;
+    current_x_ = other.current_x_;
+    current_y_ = other.current_y_;
+    next_piece_ = other.next_piece_;
+    completed_lines_ = other.completed_lines_;
+    status_ = other.status_;
+    game_ticks_ = other.game_ticks_;
+    drop_ticks_ = other.drop_ticks_;
+    pieces_ = other.pieces_;
+  }
+
+  // Appends the complete state of the game to out: the board, pieces, counters and the piece generator. The board
+  // is written from the top of its stack down, so the size grows with the stack, not the board.
+  void Serialize(std::vector<uint8_t>* out) const;
+
+  // Restores a state written by Serialize() from a game of the same size. Returns false, leaving the game as it was,
+  // if the data is not such a state, including one whose falling piece is off the board or overlaps its cells.
+  bool Deserialize(const uint8_t* data, size_t size);
+
+  bool IsGameOver() const { return status_ == Status::GAMEOVER; }
+  bool IsInPlay() const { return status_ == Status::PLAY; }
+
+  int width() const { return board_.width(); }
+  int height() const { return board_.height(); }
+  const Board& board() const { return board_; }
+  // For setting up positions directly, as benchmarks do.
+  Board* mutable_board() { return &board_; }
+  int current_piece() const { return current_piece_; }
+  int current_orientation() const { return current_orientation_; }
+  // Shape of the falling piece, offset from its origin.
+  const PieceMask& current_mask() const { return orientations.masks[current_piece_-1][current_orientation_]; }
+  // Origin of the falling piece, from which its blocks are offset by orientations.shapes.
+  int current_x() const { return current_x_; }
+  int current_y() const { return current_y_; }
+  // Fills coords with the board positions of the falling piece's blocks.
+  void CurrentCoords(Coords coords) const;
+  int next_piece() const { return next_piece_; }
+  int completed_lines() const { return completed_lines_; }
+  int level() const { return completed_lines_ / 3; }
+  Status status() const { return status_; }
+  uint64_t game_ticks() const { return game_ticks_; }
+  // Number of pieces that have entered the board.
+  int pieces() const { return pieces_; }
+
+ private:
+  PieceGenerator generator_;
+  Board board_;
+  int current_piece_;
+  int current_orientation_;
+  int current_x_;
+  int current_y_;
+  int next_piece_;
+  int completed_lines_;
+  Status status_;
+  uint64_t game_ticks_;
+  uint64_t drop_ticks_;
+  int pieces_;
+};
+
+#endif  // TETRIS_GAME_H_
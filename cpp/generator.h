@@ -0,0 +1,148 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Seeded, per-game piece generation.
+
+#ifndef TETRIS_GENERATOR_H_
+#define TETRIS_GENERATOR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "varint.h"
+
+// PCG32 (permuted congruential generator): 16 bytes of state, a multiply and an add per number, and no shared
+// state, so each game can own one.
+class Pcg32 {
+ public:
+  explicit Pcg32(const uint64_t seed=0, const uint64_t stream=0)
+   : state_(0),
+     increment_((stream << 1) | 1) {
+    Next();
+    state_ += seed;
+    Next();
+  }
+
+  uint32_t Next() {
+    const uint64_t old = state_;
+    state_ = old * 6364136223846793005ULL + increment_;
+    const uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+    const uint32_t rotation = old >> 59;
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+  }
+
+  // Uniform in [0, bound), without modulo bias (Lemire's multiply and reject).
+  uint32_t Below(const uint32_t bound) {
+    uint64_t product = static_cast<uint64_t>(Next()) * bound;
+    if (static_cast<uint32_t>(product) < bound) {
+      const uint32_t threshold = -bound % bound;
+      while (static_cast<uint32_t>(product) < threshold) {
+        product = static_cast<uint64_t>(Next()) * bound;
+      }
+    }
+    return product >> 32;
+  }
+
+  void Serialize(std::vector<uint8_t>* const out) const {
+    PutVarint(out, state_);
+    PutVarint(out, increment_);
+  }
+
+  // Restores a state written by Serialize(), advancing *p past it. Returns false, leaving the generator as it was,
+  // if it is not such a state.
+  bool Deserialize(const uint8_t** const p, const uint8_t* const end) {
+    uint64_t state, increment;
+    if (!GetVarint(p, end, &state) || !GetVarint(p, end, &increment) || !(increment & 1)) {
+      return false;
+    }
+    state_ = state;
+    increment_ = increment;
+    return true;
+  }
+
+ private:
+  uint64_t state_;
+  uint64_t increment_;
+};
+
+// Deals pieces numbered 1 to count. UNIFORM picks each piece independently, as the game always has. BAG deals
+// every piece once, in random order, before starting the next bag (the "7-bag").
+class PieceGenerator {
+ public:
+  enum Policy {UNIFORM, BAG};
+
+  static const int MAX_PIECES = 7;
+
+  explicit PieceGenerator(const uint64_t seed=0, const Policy policy=Policy::UNIFORM, const int count=MAX_PIECES)
+   : random_(seed),
+     policy_(policy),
+     count_(count),
+     dealt_(count),
+     bag_() {
+  }
+
+  int Next() {
+    if (policy_ == Policy::UNIFORM) {
+      return 1 + random_.Below(count_);
+    }
+    if (dealt_ == count_) {
+      for (int i = 0; i < count_; ++i) {
+        bag_[i] = i + 1;
+      }
+      // Fisher-Yates shuffle.
+      for (int i = count_ - 1; i > 0; --i) {
+        const int j = random_.Below(i + 1);
+        const uint8_t swap = bag_[i];
+        bag_[i] = bag_[j];
+        bag_[j] = swap;
+      }
+      dealt_ = 0;
+    }
+    return bag_[dealt_++];
+  }
+
+  Policy policy() const { return policy_; }
+
+  void Serialize(std::vector<uint8_t>* const out) const {
+    random_.Serialize(out);
+    PutVarint(out, policy_);
+    PutVarint(out, count_);
+    PutVarint(out, dealt_);
+    out->insert(out->end(), bag_, bag_ + MAX_PIECES);
+  }
+
+  // Restores a state written by Serialize(), advancing *p past it. Returns false, leaving the generator as it was,
+  // if it is not such a state. The pieces of the bag still to be dealt must be pieces 1 to count, as they are dealt
+  // without checking.
+  bool Deserialize(const uint8_t** const p, const uint8_t* const end) {
+    Pcg32 random;
+    uint64_t policy, count, dealt;
+    if (!random.Deserialize(p, end) || !GetVarint(p, end, &policy) || !GetVarint(p, end, &count) ||
+        !GetVarint(p, end, &dealt) || policy > Policy::BAG || count < 1 || count > MAX_PIECES || dealt > count ||
+        end - *p < MAX_PIECES) {
+      return false;
+    }
+    for (uint64_t i = dealt; i < count; ++i) {
+      if ((*p)[i] < 1 || (*p)[i] > count) {
+        return false;
+      }
+    }
+    random_ = random;
+    policy_ = static_cast<Policy>(policy);
+    count_ = count;
+    dealt_ = dealt;
+    std::copy(*p, *p + MAX_PIECES, bag_);
+    *p += MAX_PIECES;
+    return true;
+  }
+
+ private:
+  Pcg32 random_;
+  Policy policy_;
+  int count_;
+  int dealt_;
+  uint8_t bag_[MAX_PIECES];
+};
+
+#endif  // TETRIS_GENERATOR_H_
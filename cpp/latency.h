@@ -0,0 +1,71 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// A fixed-size histogram of durations for latency percentiles.
+
+#ifndef TETRIS_LATENCY_H_
+#define TETRIS_LATENCY_H_
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+
+// Durations in nanoseconds, counted in buckets that split each power of two into 32, so percentiles are accurate
+// to about 3% at any scale. Recording is a few instructions and never allocates.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(), count_(0), max_(0) {}
+
+  void Record(const uint64_t ns) {
+    ++counts_[Bucket(ns)];
+    ++count_;
+    max_ = std::max(max_, ns);
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+
+  // The duration at or below which a fraction q of the recorded durations fall, rounded up to the top of its
+  // bucket. Zero when nothing was recorded.
+  uint64_t Percentile(const double q) const {
+    const uint64_t rank = std::max<uint64_t>(1, q * count_ + 0.5);
+    uint64_t seen = 0;
+    for (int b = 0; b < NUM_BUCKETS; ++b) {
+      seen += counts_[b];
+      if (seen >= rank) {
+        return std::min(BucketLimit(b), max_);
+      }
+    }
+    return max_;
+  }
+
+ private:
+  static const int SUB_BITS = 5;
+  static const int NUM_BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+  // Values below 32 have a bucket each. Above, the bucket is the position of the highest set bit and the 5 bits
+  // below it.
+  static int Bucket(const uint64_t ns) {
+    if (ns < (1 << SUB_BITS)) {
+      return ns;
+    }
+    const int shift = std::bit_width(ns) - 1 - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + ((ns >> shift) & ((1 << SUB_BITS) - 1));
+  }
+
+  // The largest value in a bucket.
+  static uint64_t BucketLimit(const int bucket) {
+    if (bucket < (1 << SUB_BITS)) {
+      return bucket;
+    }
+    const int shift = (bucket >> SUB_BITS) - 1;
+    const uint64_t low = static_cast<uint64_t>((1 << SUB_BITS) + (bucket & ((1 << SUB_BITS) - 1))) << shift;
+    return low + ((uint64_t{1} << shift) - 1);
+  }
+
+  uint64_t counts_[NUM_BUCKETS];
+  uint64_t count_;
+  uint64_t max_;
+};
+
+#endif  // TETRIS_LATENCY_H_
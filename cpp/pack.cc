@@ -0,0 +1,25 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Packs asset files into one archive for the game to map at startup.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "assets.h"
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "usage: " << *argv << " archive file...\n\n"
+              << "  Files are stored under the paths given, which are the names the game looks them up by.\n";
+    return EXIT_FAILURE;
+  }
+  std::string error;
+  if (!AssetArchive::Pack(argv[1], std::vector<std::string>(argv + 2, argv + argc), &error)) {
+    std::cerr << argv[1] << ": " << error << "\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// The tetromino tables, and every orientation of every piece derived from them at compile time.
+
+#ifndef TETRIS_PIECES_H_
+#define TETRIS_PIECES_H_
+
+#include "board.h"
+
+const int NUM_TETROMINOS = 7;
+
+typedef int Coords[4][2];
+
+// Starting position of each type of tetromino. Each tetromino is 4 (x,y) coordinates.
+inline constexpr int starting_positions[NUM_TETROMINOS][4][2] = {
+  {{-1,0}, {-1,1}, {0,1}, {1,1}},  // Leftward L piece.
+  {{-1,1}, {0,1},  {0,0}, {1,0}},  // Rightward Z piece.
+  {{-2,0}, {-1,0}, {0,0}, {1,0}},  // Long straight piece.
+  {{-1,1}, {0,1},  {0,0}, {1,1}},  // Bump in middle piece.
+  {{-1,1}, {0,1},  {1,1}, {1,0}},  // L piece.
+  {{-1,0}, {0,0},  {0,1}, {1,1}},  // Z piece.
+  {{-1,0}, {-1,1}, {0,0}, {0,1}},  // Square piece.
+};
+
+// Array of rotations for each tetromino to move from orientation x -> (x + 1) % 4.
+// Each rotation is an array of 4 rotations -- one for each orientation of a tetromino.
+// For each rotation, there is an array of 4 (int x, int y) coordinate diffs for each block of the tetromino.
+// The coordinate diffs map each block to its new location.
+// Thus: [block][orientation][component][x|y] to map the 4 components of each block in each orientation.
+inline constexpr int rotations[NUM_TETROMINOS][4][4][2] = {
+  // Leftward L piece.
+  {{{0,2},  {1,1},   {0,0}, {-1,-1}},
+   {{2,0},  {1,-1},  {0,0}, {-1,1}},
+   {{0,-2}, {-1,-1}, {0,0}, {1,1}},
+   {{-2,0}, {-1,1},  {0,0}, {1,-1}}},
+  // Rightward Z piece. Orientation symmetry: 0==2 and 1==3.
+  {{{1,0},  {0,1},  {-1,0}, {-2,1}},
+   {{-1,0}, {0,-1}, {1,0},  {2,-1}},
+   {{1,0},  {0,1},  {-1,0}, {-2,1}},
+   {{-1,0}, {0,-1}, {1,0},  {2,-1}}},
+  // Long straight piece. Orientation symmetry: 0==2 and 1==3.
+  {{{2,-2}, {1,-1}, {0,0}, {-1,1}},
+   {{-2,2}, {-1,1}, {0,0}, {1,-1}},
+   {{2,-2}, {1,-1}, {0,0}, {-1,1}},
+   {{-2,2}, {-1,1}, {0,0}, {1,-1}}},
+  // Bump in middle piece.
+  {{{1,1},   {0,0}, {-1,1},  {-1,-1}},
+   {{1,-1},  {0,0}, {1,1},   {-1,1}},
+   {{-1,-1}, {0,0}, {1,-1},  {1,1}},
+   {{-1,1},  {0,0}, {-1,-1}, {1,-1}}},
+  // L Piece.
+  {{{1,1},   {0,0}, {-1,-1}, {-2,0}},
+   {{1,-1},  {0,0}, {-1,1},  {0,2}},
+   {{-1,-1}, {0,0}, {1,1},   {2,0}},
+   {{-1,1},  {0,0}, {1,-1},  {0,-2}}},
+  // Z piece. Orientation symmetry: 0==2 and 1==3.
+  {{{1,0},  {0,1},  {-1,0}, {-2,1}},
+   {{-1,0}, {0,-1}, {1,0},  {2,-1}},
+   {{1,0},  {0,1},  {-1,0}, {-2,1}},
+   {{-1,0}, {0,-1}, {1,0},  {2,-1}}},
+  // Square piece. Orientation symmetry: 0==1==2==3.
+  {{{0,0}, {0,0}, {0,0}, {0,0}},
+   {{0,0}, {0,0}, {0,0}, {0,0}},
+   {{0,0}, {0,0}, {0,0}, {0,0}},
+   {{0,0}, {0,0}, {0,0}, {0,0}}}
+};
+
+// Each orientation of each piece, derived from starting_positions and rotations. The origin of a piece is the
+// center column of the top row when it enters the board, where orientation 0 is at the starting positions, so
+// the spawn position of a piece is its orientation 0 shape offset from (width / 2, 0). Rotation keeps the origin.
+struct OrientationTable {
+  // Block offsets from the origin, indexed [piece-1][orientation][block][x|y].
+  int shapes[NUM_TETROMINOS][4][4][2];
+  // Row masks of the shapes. The x and y of a mask are the offset of its bounding box from the origin.
+  PieceMask masks[NUM_TETROMINOS][4];
+  // The first orientation with an identical shape, which is the orientation itself for asymmetric shapes.
+  int same_as[NUM_TETROMINOS][4];
+};
+
+constexpr OrientationTable MakeOrientationTable() {
+  OrientationTable table = {};
+  for (int p = 0; p < NUM_TETROMINOS; ++p) {
+    for (int i = 0; i < 4; ++i) {
+      table.shapes[p][0][i][0] = starting_positions[p][i][0];
+      table.shapes[p][0][i][1] = starting_positions[p][i][1];
+    }
+    for (int o = 1; o < 4; ++o) {
+      for (int i = 0; i < 4; ++i) {
+        table.shapes[p][o][i][0] = table.shapes[p][o-1][i][0] + rotations[p][o-1][i][0];
+        table.shapes[p][o][i][1] = table.shapes[p][o-1][i][1] + rotations[p][o-1][i][1];
+      }
+    }
+    for (int o = 0; o < 4; ++o) {
+      table.masks[p][o] = PieceMask::FromCoords(table.shapes[p][o]);
+      table.same_as[p][o] = o;
+      for (int q = o - 1; q >= 0; --q) {
+        const PieceMask& a = table.masks[p][o];
+        const PieceMask& b = table.masks[p][q];
+        if (a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height && a.rows[0] == b.rows[0] &&
+            a.rows[1] == b.rows[1] && a.rows[2] == b.rows[2] && a.rows[3] == b.rows[3]) {
+          table.same_as[p][o] = q;
+        }
+      }
+    }
+  }
+  return table;
+}
+
+inline constexpr OrientationTable orientations = MakeOrientationTable();
+
+// Checks that the tables are self-consistent.
+
+constexpr bool RotationsReturnToStart() {
+  for (int p = 0; p < NUM_TETROMINOS; ++p) {
+    for (int i = 0; i < 4; ++i) {
+      int dx = 0, dy = 0;
+      for (int o = 0; o < 4; ++o) {
+        dx += rotations[p][o][i][0];
+        dy += rotations[p][o][i][1];
+      }
+      if (dx || dy) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+static_assert(RotationsReturnToStart(), "Four rotations must return every block to its starting position.");
+
+constexpr bool ShapesAreTetrominos() {
+  for (int p = 0; p < NUM_TETROMINOS; ++p) {
+    for (int o = 0; o < 4; ++o) {
+      const PieceMask& mask = orientations.masks[p][o];
+      int blocks = 0;
+      for (int r = 0; r < 4; ++r) {
+        blocks += __builtin_popcountll(mask.rows[r]);
+      }
+      if (blocks != 4 || mask.width > 4 || mask.height > 4) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+static_assert(ShapesAreTetrominos(), "Every orientation must be 4 distinct blocks within a 4x4 box.");
+
+constexpr bool SymmetryIs(const int piece, const int o1, const int o2, const int o3) {
+  return orientations.same_as[piece-1][0] == 0 && orientations.same_as[piece-1][1] == o1 &&
+         orientations.same_as[piece-1][2] == o2 && orientations.same_as[piece-1][3] == o3;
+}
+static_assert(SymmetryIs(1, 1, 2, 3) && SymmetryIs(4, 1, 2, 3) && SymmetryIs(5, 1, 2, 3),
+              "The L and bump pieces have four distinct orientations.");
+static_assert(SymmetryIs(2, 1, 0, 1) && SymmetryIs(3, 1, 0, 1) && SymmetryIs(6, 1, 0, 1),
+              "The Z and long pieces have orientation symmetry 0==2 and 1==3.");
+static_assert(SymmetryIs(7, 0, 0, 0), "The square piece has orientation symmetry 0==1==2==3.");
+
+#endif  // TETRIS_PIECES_H_
@@ -0,0 +1,198 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Move generation: every position where the falling piece can come to rest.
+
+#include "placement.h"
+
+namespace {
+
+// Word w of a row of columns moved dx columns to the right (left for negative dx), with |dx| < 64.
+inline uint64_t ShiftedWord(const uint64_t* const bits, const int w, const int dx, const int words) {
+  if (dx > 0) {
+    return bits[w] << dx | (w > 0 ? bits[w - 1] >> (64 - dx) : 0);
+  }
+  if (dx < 0) {
+    return bits[w] >> -dx | (w + 1 < words ? bits[w + 1] << (64 + dx) : 0);
+  }
+  return bits[w];
+}
+
+// Extends every set bit of reach, which must be a subset of free, over the run of set bits of free it is in, across
+// the words of a row, and returns whether reach changed. Most rows are empty or were filled before, so a row is first
+// checked for a free neighbor of a reached column; only then is each direction filled, by an occluded fill of 6
+// shifts a word with the fill carried from word to word.
+inline bool FillRuns(uint64_t* const reach, const uint64_t* const free, const int words) {
+  uint64_t grows = 0;
+  for (int w = 0; w < words; ++w) {
+    const uint64_t left = w > 0 ? reach[w - 1] >> 63 : 0;
+    const uint64_t right = w + 1 < words ? reach[w + 1] << 63 : 0;
+    grows |= (reach[w] << 1 | reach[w] >> 1 | left | right) & free[w] & ~reach[w];
+  }
+  if (!grows) {
+    return false;
+  }
+  uint64_t carry = 0;
+  for (int w = 0; w < words; ++w) {
+    uint64_t fill = reach[w] | (carry & free[w]);
+    uint64_t open = free[w];
+    for (int shift = 1; shift < 64; shift *= 2) {
+      fill |= open & (fill << shift);
+      open &= open << shift;
+    }
+    carry = fill >> 63;
+    reach[w] = fill;
+  }
+  carry = 0;
+  for (int w = words - 1; w >= 0; --w) {
+    uint64_t fill = reach[w] | ((carry << 63) & free[w]);
+    uint64_t open = free[w];
+    for (int shift = 1; shift < 64; shift *= 2) {
+      fill |= open & (fill >> shift);
+      open &= open >> shift;
+    }
+    carry = fill & 1;
+    reach[w] = fill;
+  }
+  return true;
+}
+
+}  // namespace
+
+void PlacementGenerator::Generate(const Game& game, std::vector<Placement>* placements) {
+  placements->clear();
+  if (game.IsGameOver()) {
+    return;
+  }
+  if (game.board().words() == 1) {
+    GenerateWords<1>(game, placements);
+  } else {
+    GenerateWords<0>(game, placements);
+  }
+}
+
+template <int WORDS>
+void PlacementGenerator::GenerateWords(const Game& game, std::vector<Placement>* placements) {
+  const Board& board = game.board();
+  const int height = board.height();
+  const int words = WORDS ? WORDS : board.words();
+  const int piece = game.current_piece();
+
+  const PieceMask* const masks = orientations.masks[piece-1];
+  const int* const same_as = orientations.same_as[piece-1];
+  // The words of orientation o in row y.
+  auto row_of = [&](std::vector<uint64_t>& rows, const int o, const int y) { return &rows[(o*height + y)*words]; };
+
+  // Columns of the bounding box's left edge where each orientation fits in each row.
+  free_.assign(4 * height * words, 0);
+  reach_.assign(4 * height * words, 0);
+  for (int o = 0; o < 4; ++o) {
+    const PieceMask& mask = masks[o];
+    const int columns = board.width() - mask.width + 1;
+    for (int y = 0; y + mask.height <= height; ++y) {
+      uint64_t* const free = row_of(free_, o, y);
+      // Blocked columns first: a block c columns into the bounding box is blocked by a cell c columns to the right.
+      for (int i = 0; i < mask.height; ++i) {
+        const uint64_t* const row = board.Row(y + i);
+        for (uint64_t b = mask.rows[i]; b; b &= b - 1) {
+          const int c = __builtin_ctzll(b);
+          for (int w = 0; w < words; ++w) {
+            free[w] |= ShiftedWord(row, w, -c, words);
+          }
+        }
+      }
+      for (int w = 0; w < words; ++w) {
+        const int in_bounds = std::min(std::max(columns - 64*w, 0), 64);
+        free[w] = ~free[w] & (in_bounds == 64 ? ~uint64_t{0} : (uint64_t{1} << in_bounds) - 1);
+      }
+    }
+  }
+
+  const int orientation = game.current_orientation();
+  const int start_x = game.current_x() + masks[orientation].x;
+  const int start_y = game.current_y() + masks[orientation].y;
+  row_of(reach_, orientation, start_y)[start_x >> 6] = uint64_t{1} << (start_x & 63);
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (int o = 0; o < 4; ++o) {
+      const int rows = height - masks[o].height + 1;
+      for (int y = 0; y < rows; ++y) {
+        // Soft drop from the row above, then slide left and right as far as the row allows.
+        uint64_t* const reach = row_of(reach_, o, y);
+        const uint64_t* const free = row_of(free_, o, y);
+        if (WORDS == 1) {
+          // Runs within one word are short, so shifting by one column until nothing changes is quicker.
+          uint64_t r = *reach | (y > 0 ? reach[-1] & *free : 0);
+          for (uint64_t prev = 0; r != prev;) {
+            prev = r;
+            r |= ((r << 1) | (r >> 1)) & *free;
+          }
+          if (r != *reach) {
+            *reach = r;
+            changed = true;
+          }
+          continue;
+        }
+        if (y > 0) {
+          const uint64_t* const above = reach - words;
+          for (int w = 0; w < words; ++w) {
+            const uint64_t dropped = above[w] & free[w] & ~reach[w];
+            reach[w] |= dropped;
+            changed |= dropped != 0;
+          }
+        }
+        changed |= FillRuns(reach, free, words);
+      }
+
+      // Rotation keeps the origin, so the bounding box moves by the difference in offsets.
+      const int next = (o + 1) % 4;
+      const int dx = masks[next].x - masks[o].x;
+      const int dy = masks[next].y - masks[o].y;
+      const int next_rows = height - masks[next].height + 1;
+      for (int y = 0; y < rows; ++y) {
+        const int ny = y + dy;
+        if (ny < 0 || ny >= next_rows) {
+          continue;
+        }
+        const uint64_t* const reach = row_of(reach_, o, y);
+        if (WORDS == 1 && !*reach) {
+          continue;
+        }
+        uint64_t* const next_reach = row_of(reach_, next, ny);
+        const uint64_t* const next_free = row_of(free_, next, ny);
+        for (int w = 0; w < words; ++w) {
+          const uint64_t r = ShiftedWord(reach, w, dx, words) & next_free[w];
+          if (r & ~next_reach[w]) {
+            next_reach[w] |= r;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  // A reachable position locks when the row below is blocked. Orientations with a shape identical to an earlier
+  // one are merged into it, as they cover the same cells from the same origin.
+  for (int o = 0; o < 4; ++o) {
+    if (same_as[o] != o) {
+      continue;
+    }
+    const int rows = height - masks[o].height + 1;
+    for (int y = 0; y < rows; ++y) {
+      for (int w = 0; w < words; ++w) {
+        uint64_t locks = 0;
+        for (int p = o; p < 4; ++p) {
+          if (same_as[p] == o) {
+            const uint64_t below = y + 1 < rows ? row_of(free_, p, y + 1)[w] : 0;
+            locks |= row_of(reach_, p, y)[w] & ~below;
+          }
+        }
+        for (; locks; locks &= locks - 1) {
+          const int x = 64*w + __builtin_ctzll(locks);
+          placements->push_back(Placement{.orientation=o, .x=x - masks[o].x, .y=y - masks[o].y});
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,47 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Move generation: every position where the falling piece can come to rest.
+
+#ifndef TETRIS_PLACEMENT_H_
+#define TETRIS_PLACEMENT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+#include "game.h"
+#include "pieces.h"
+
+// A final position of the falling piece. The blocks are at (x,y) plus orientations.shapes[piece-1][orientation].
+struct Placement {
+  int orientation;
+  int x;
+  int y;
+};
+
+// Finds every distinct position where the falling piece can lock, reachable from where it is now by moving left,
+// right, down and rotating, including positions that need a shift or rotation after a soft drop. Orientations with
+// the same shape (0==2 and 1==3 for the S, Z and long pieces, all four for the square) are reported once.
+//
+// Reachability is computed on bitboards: for each orientation and row, a bit for each bounding box column where the
+// piece fits, in as many words as a row of the board, and reachable columns are flood filled along rows, down
+// between rows and across rotations until nothing changes. A generator keeps its buffers between calls so that it
+// does not allocate.
+class PlacementGenerator {
+ public:
+  // Replaces the contents of placements with the lock positions of the game's falling piece.
+  void Generate(const Game& game, std::vector<Placement>* placements);
+
+ private:
+  // Generate() for rows of WORDS words, or of any number for 0, so that the loops over the words of a row of a
+  // board of up to 64 columns are unrolled.
+  template <int WORDS>
+  void GenerateWords(const Game& game, std::vector<Placement>* placements);
+
+  // Row-major [orientation][bounding box top row][word] bits of bounding box left columns.
+  std::vector<uint64_t> free_;
+  std::vector<uint64_t> reach_;
+};
+
+#endif  // TETRIS_PLACEMENT_H_
@@ -0,0 +1,63 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Move policies that play a Game without a human at the keyboard.
+
+#include "policy.h"
+
+#include <cstdlib>
+
+const char* const POLICY_NAMES = "random drop greedy";
+
+void RandomPolicy::Play(Game* game) {
+  // One extra choice for pressing nothing.
+  const int choice = random_.Below(Game::Input::ROTATE + 2);
+  if (choice <= Game::Input::ROTATE) {
+    game->HandleInput(static_cast<Game::Input>(choice));
+  }
+}
+
+void DropPolicy::Play(Game* game) {
+  game->HandleInput(Game::Input::DROP);
+}
+
+void GreedyPolicy::Play(Game* game) {
+  if (game->pieces() == placed_piece_ || !game->IsInPlay()) {
+    return;
+  }
+  placed_piece_ = game->pieces();
+  generator_.Generate(*game, &placements_);
+  const Placement* best = nullptr;
+  double best_score = 0;
+  for (const Placement& placement : placements_) {
+    const double score = Score(*game, placement);
+    if (!best || score > best_score) {
+      best = &placement;
+      best_score = score;
+    }
+  }
+  if (best) {
+    game->MoveTo(best->orientation, best->x, best->y);
+  }
+}
+
+double GreedyPolicy::Score(const Game& game, const Placement& placement) {
+  const PieceMask& mask = orientations.masks[game.current_piece()-1][placement.orientation];
+  int lines;
+  const BoardFeatures features = evaluator_.AfterLock(game.board(), mask, placement.x + mask.x, placement.y + mask.y,
+                                                      &lines);
+  return 0.76 * lines - 0.51 * features.aggregate_height - 0.36 * features.holes - 0.18 * features.bumpiness;
+}
+
+std::unique_ptr<Policy> MakePolicy(const std::string& name) {
+  if (name == "random") {
+    return std::make_unique<RandomPolicy>();
+  }
+  if (name == "drop") {
+    return std::make_unique<DropPolicy>();
+  }
+  if (name == "greedy") {
+    return std::make_unique<GreedyPolicy>();
+  }
+  return nullptr;
+}
@@ -0,0 +1,68 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Move policies that play a Game without a human at the keyboard.
+
+#ifndef TETRIS_POLICY_H_
+#define TETRIS_POLICY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "board_features.h"
+#include "game.h"
+#include "generator.h"
+#include "placement.h"
+
+class Policy {
+ public:
+  virtual ~Policy() {}
+
+  // Called at the start of each game with the game's seed, so that a policy's own choices are reproducible.
+  virtual void Reset(uint64_t seed) {}
+
+  // Called once per tick before the game advances. Applies any number of inputs to the game with HandleInput().
+  virtual void Play(Game* game) = 0;
+};
+
+// Presses a uniformly random key, or no key, each tick.
+class RandomPolicy : public Policy {
+ public:
+  void Reset(const uint64_t seed) override { random_ = Pcg32(seed, 1); }
+  void Play(Game* game) override;
+
+ private:
+  Pcg32 random_;
+};
+
+// Drops every piece straight down from where it enters the board.
+class DropPolicy : public Policy {
+ public:
+  void Play(Game* game) override;
+};
+
+// Moves each new piece to the lock position with the best score after clearing lines, weighing completed lines
+// against aggregate column height, holes and bumpiness.
+class GreedyPolicy : public Policy {
+ public:
+  void Reset(uint64_t seed) override { placed_piece_ = 0; }
+  void Play(Game* game) override;
+
+ private:
+  double Score(const Game& game, const Placement& placement);
+
+  PlacementGenerator generator_;
+  std::vector<Placement> placements_;
+  FeatureEvaluator evaluator_;
+  int placed_piece_ = 0;
+};
+
+// Returns the policy with the given name, or nullptr if there is none.
+std::unique_ptr<Policy> MakePolicy(const std::string& name);
+
+// Names accepted by MakePolicy(), separated by spaces.
+extern const char* const POLICY_NAMES;
+
+#endif  // TETRIS_POLICY_H_
@@ -0,0 +1,128 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Scoped phase timers, buffered in memory and exported as a Chrome trace and a summary table.
+
+#include "profile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Timing {
+  const char* name;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Each thread appends to its own buffer without locking. The buffers are registered once, under the lock, and
+// are only read after the threads are done recording.
+struct ThreadBuffer {
+  int thread;
+  size_t dropped = 0;
+  std::vector<Timing> timings;
+};
+
+std::mutex buffers_lock;
+std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+size_t max_timings = 0;
+
+ThreadBuffer* ThisThread() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (!buffer) {
+    std::lock_guard<std::mutex> lock(buffers_lock);
+    buffers.push_back(std::make_unique<ThreadBuffer>());
+    buffer = buffers.back().get();
+    buffer->thread = buffers.size();
+    buffer->timings.reserve(max_timings);
+  }
+  return buffer;
+}
+
+}  // namespace
+
+void Profiler::Enable(const size_t max_events) {
+  max_timings = max_events;
+  ThisThread();
+  enabled_ = true;
+}
+
+void Profiler::Record(const char* const name, const uint64_t begin, const uint64_t end) {
+  ThreadBuffer* const buffer = ThisThread();
+  if (buffer->timings.size() < max_timings) {
+    buffer->timings.push_back(Timing{.name=name, .begin=begin, .end=end});
+  } else {
+    ++buffer->dropped;
+  }
+}
+
+bool Profiler::WriteChromeTrace(const char* const path, std::string* const error) {
+  FILE* const file = fopen(path, "w");
+  if (!file) {
+    *error = std::string("cannot create ") + path + ": " + strerror(errno);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(buffers_lock);
+  uint64_t start = UINT64_MAX;
+  for (const auto& buffer : buffers) {
+    for (const Timing& timing : buffer->timings) {
+      start = std::min(start, timing.begin);
+    }
+  }
+  // Complete ("X") events, with times in microseconds from the first timing.
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+  const char* separator = "\n";
+  for (const auto& buffer : buffers) {
+    for (const Timing& timing : buffer->timings) {
+      fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", separator,
+              timing.name, buffer->thread, (timing.begin - start)/1e3, (timing.end - timing.begin)/1e3);
+      separator = ",\n";
+    }
+  }
+  fputs("\n]}\n", file);
+  if (fclose(file) != 0) {
+    *error = std::string("cannot write ") + path;
+    return false;
+  }
+  return true;
+}
+
+void Profiler::PrintSummary() {
+  struct Phase {
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+  };
+  std::map<std::string, Phase> phases;
+  size_t dropped = 0;
+  {
+    std::lock_guard<std::mutex> lock(buffers_lock);
+    for (const auto& buffer : buffers) {
+      for (const Timing& timing : buffer->timings) {
+        Phase& phase = phases[timing.name];
+        const uint64_t ns = timing.end - timing.begin;
+        ++phase.count;
+        phase.total += ns;
+        phase.max = std::max(phase.max, ns);
+      }
+      dropped += buffer->dropped;
+    }
+  }
+  std::vector<std::pair<std::string, Phase>> sorted(phases.begin(), phases.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.total > b.second.total; });
+  printf("%-20s %10s %12s %10s %10s\n", "phase", "count", "total ms", "mean us", "max us");
+  for (const auto& [name, phase] : sorted) {
+    printf("%-20s %10lu %12.3f %10.3f %10.3f\n", name.c_str(), phase.count, phase.total/1e6,
+           phase.total/1e3/phase.count, phase.max/1e3);
+  }
+  if (dropped) {
+    printf("%zu timings dropped after the buffers filled.\n", dropped);
+  }
+}
@@ -0,0 +1,261 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Recording games as compact replays, and re-executing them faster than real time.
+
+#include "replay.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "varint.h"
+
+namespace {
+
+// Event kinds 0-4 are the values of Game::Input.
+enum EventKind {PAUSE_EVENT = 5, KEYFRAME_EVENT = 6, END_EVENT = 7};
+
+const char MAGIC[4] = {'T', 'T', 'R', 'P'};
+// Version 2 games fall more than one row per drop above level 14, and keyframes hold the board from the top of its
+// stack down.
+const uint64_t VERSION = 2;
+
+}  // namespace
+
+ReplayWriter::ReplayWriter(const char* const path, const ReplayHeader& header)
+ : file_(fopen(path, "wb")),
+   failed_(false),
+   ended_(false),
+   keyframe_interval_(header.keyframe_interval),
+   last_tick_(0) {
+  if (file_) {
+    // The writer does its own buffering.
+    setvbuf(file_, nullptr, _IONBF, 0);
+  }
+  buffer_.reserve(BUFFER_SIZE);
+  buffer_.insert(buffer_.end(), MAGIC, MAGIC + sizeof(MAGIC));
+  PutVarint(&buffer_, VERSION);
+  PutVarint(&buffer_, header.seed);
+  PutVarint(&buffer_, header.policy);
+  PutVarint(&buffer_, header.level);
+  PutVarint(&buffer_, header.width);
+  PutVarint(&buffer_, header.height);
+  PutVarint(&buffer_, header.keyframe_interval);
+}
+
+ReplayWriter::~ReplayWriter() {
+  Flush();
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+void ReplayWriter::Event(const uint64_t tick, const int kind) {
+  PutVarint(&buffer_, ((tick - last_tick_) << 3) | kind);
+  last_tick_ = tick;
+}
+
+void ReplayWriter::Input(const Game& game, const Game::Input input) {
+  if (!ended_) {
+    Event(game.game_ticks(), input);
+    if (buffer_.size() >= BUFFER_SIZE) {
+      Flush();
+    }
+  }
+}
+
+void ReplayWriter::Pause(const Game& game) {
+  if (!ended_) {
+    Event(game.game_ticks(), PAUSE_EVENT);
+  }
+}
+
+void ReplayWriter::Tick(const Game& game) {
+  if (ended_ || keyframe_interval_ <= 0 || game.game_ticks() % keyframe_interval_) {
+    return;
+  }
+  Event(game.game_ticks(), KEYFRAME_EVENT);
+  state_.clear();
+  game.Serialize(&state_);
+  PutVarint(&buffer_, state_.size());
+  buffer_.insert(buffer_.end(), state_.begin(), state_.end());
+  if (buffer_.size() >= BUFFER_SIZE) {
+    Flush();
+  }
+}
+
+void ReplayWriter::End(const Game& game) {
+  if (ended_) {
+    return;
+  }
+  Event(game.game_ticks(), END_EVENT);
+  PutVarint(&buffer_, game.completed_lines());
+  PutVarint(&buffer_, game.pieces());
+  PutVarint(&buffer_, game.status());
+  ended_ = true;
+  Flush();
+}
+
+void ReplayWriter::Flush() {
+  if (file_ && !buffer_.empty() && fwrite(buffer_.data(), 1, buffer_.size(), file_) != buffer_.size()) {
+    failed_ = true;
+  }
+  buffer_.clear();
+}
+
+bool Replay::Load(const char* const path, std::string* const error) {
+  FILE* const file = fopen(path, "rb");
+  if (!file) {
+    *error = std::string("cannot open ") + path + ": " + strerror(errno);
+    return false;
+  }
+  data_.clear();
+  uint8_t chunk[1 << 16];
+  for (size_t n; (n = fread(chunk, 1, sizeof(chunk), file)) > 0;) {
+    data_.insert(data_.end(), chunk, chunk + n);
+  }
+  const bool read_error = ferror(file);
+  fclose(file);
+  if (read_error) {
+    *error = std::string("cannot read ") + path;
+    return false;
+  }
+
+  const uint8_t* p = data_.data();
+  const uint8_t* const end = p + data_.size();
+  if (data_.size() < sizeof(MAGIC) || memcmp(p, MAGIC, sizeof(MAGIC))) {
+    *error = "not a replay";
+    return false;
+  }
+  p += sizeof(MAGIC);
+  uint64_t values[7];
+  for (uint64_t& value : values) {
+    if (!GetVarint(&p, end, &value)) {
+      *error = "truncated header";
+      return false;
+    }
+  }
+  // Games start at level 15 at most.
+  if (values[0] != VERSION || values[2] > PieceGenerator::Policy::BAG || values[3] > 15 || values[4] < 1 ||
+      values[4] > Board::MAX_WIDTH || values[5] < 1 || values[5] > Board::MAX_CELLS ||
+      static_cast<long>(values[4]) * static_cast<long>(values[5]) > Board::MAX_CELLS) {
+    *error = "unsupported header";
+    return false;
+  }
+  header_ = ReplayHeader{.seed=values[1], .policy=static_cast<PieceGenerator::Policy>(values[2]),
+                         .level=static_cast<int>(values[3]), .width=static_cast<int>(values[4]),
+                         .height=static_cast<int>(values[5]), .keyframe_interval=static_cast<int>(values[6])};
+  events_ = p - data_.data();
+
+  // Index the keyframes. A recording cut short may end in a partial event, which is dropped.
+  keyframes_.clear();
+  has_end_ = false;
+  last_tick_ = 0;
+  uint64_t tick = 0;
+  while (p < end && !has_end_) {
+    const uint8_t* const event = p;
+    uint64_t v, a, b, c;
+    bool complete = GetVarint(&p, end, &v);
+    const uint64_t at = tick + (v >> 3);
+    if (complete && (v & 7) == KEYFRAME_EVENT) {
+      complete = GetVarint(&p, end, &a) && a <= static_cast<uint64_t>(end - p);
+      if (complete) {
+        keyframes_.push_back(Keyframe{.tick=at, .state=static_cast<size_t>(p - data_.data()), .size=a,
+                                      .next=static_cast<size_t>(p - data_.data() + a)});
+        p += a;
+      }
+    } else if (complete && (v & 7) == END_EVENT) {
+      complete = GetVarint(&p, end, &a) && GetVarint(&p, end, &b) && GetVarint(&p, end, &c);
+      has_end_ = complete;
+    }
+    if (!complete) {
+      data_.resize(event - data_.data());
+      break;
+    }
+    tick = at;
+  }
+  last_tick_ = tick;
+  return true;
+}
+
+std::unique_ptr<Game> Replay::Seek(const uint64_t tick, std::string* const error) const {
+  return Run(std::min(tick, last_tick_), true, error);
+}
+
+std::unique_ptr<Game> Replay::Verify(std::string* const error) const {
+  if (!has_end_) {
+    *error = "no end event, the recording was cut short";
+    return nullptr;
+  }
+  return Run(last_tick_, false, error);
+}
+
+std::unique_ptr<Game> Replay::Run(const uint64_t tick, const bool from_keyframe, std::string* const error) const {
+  auto game = std::make_unique<Game>(header_.level, header_.width, header_.height,
+                                     PieceGenerator(header_.seed, header_.policy));
+  game->AddBoardPiece();
+  size_t position = events_;
+  uint64_t current = 0;
+  if (from_keyframe) {
+    auto keyframe = std::upper_bound(keyframes_.begin(), keyframes_.end(), tick,
+                                     [](const uint64_t t, const Keyframe& k) { return t < k.tick; });
+    if (keyframe != keyframes_.begin()) {
+      --keyframe;
+      if (!game->Deserialize(&data_[keyframe->state], keyframe->size)) {
+        *error = "bad keyframe at tick " + std::to_string(keyframe->tick);
+        return nullptr;
+      }
+      position = keyframe->next;
+      current = keyframe->tick;
+    }
+  }
+
+  std::vector<uint8_t> state;
+  const uint8_t* p = data_.data() + position;
+  const uint8_t* const end = data_.data() + data_.size();
+  while (p < end) {
+    uint64_t v;
+    GetVarint(&p, end, &v);
+    const uint64_t at = current + (v >> 3);
+    if (at > tick) {
+      break;
+    }
+    while (game->game_ticks() < at) {
+      game->Tick();
+    }
+    current = at;
+    const int kind = v & 7;
+    if (kind <= Game::Input::ROTATE) {
+      game->HandleInput(static_cast<Game::Input>(kind));
+    } else if (kind == PAUSE_EVENT) {
+      game->Pause();
+    } else if (kind == KEYFRAME_EVENT) {
+      uint64_t size;
+      GetVarint(&p, end, &size);
+      state.clear();
+      game->Serialize(&state);
+      if (state.size() != size || memcmp(state.data(), p, size)) {
+        *error = "diverged from the keyframe at tick " + std::to_string(at);
+        return nullptr;
+      }
+      p += size;
+    } else {
+      uint64_t lines, pieces, status;
+      GetVarint(&p, end, &lines);
+      GetVarint(&p, end, &pieces);
+      GetVarint(&p, end, &status);
+      if (lines != static_cast<uint64_t>(game->completed_lines()) ||
+          pieces != static_cast<uint64_t>(game->pieces()) || status != static_cast<uint64_t>(game->status())) {
+        *error = "ended with " + std::to_string(game->completed_lines()) + " lines and " +
+                 std::to_string(game->pieces()) + " pieces instead of the recorded " + std::to_string(lines) +
+                 " lines and " + std::to_string(pieces) + " pieces";
+        return nullptr;
+      }
+    }
+  }
+  while (game->game_ticks() < tick) {
+    game->Tick();
+  }
+  return game;
+}
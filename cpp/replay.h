@@ -0,0 +1,109 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Recording games as compact replays, and re-executing them faster than real time.
+//
+// A replay is the parameters a game was created with followed by a stream of events, each a varint of the ticks
+// since the previous event shifted left by 3 and or'd with the event kind:
+//
+//   "TTRP" version seed policy level width height keyframe_interval    Header, all varints after the magic.
+//   0-4  Game::Input                                                   An input passed to Game::HandleInput().
+//   5    Pause                                                         Game::Pause().
+//   6    size state                                                    A keyframe: Game::Serialize() after the tick.
+//   7    lines pieces status                                           The end of the recording.
+//
+// Events at a tick are applied after the game has advanced to that tick, in the order recorded. Keyframes are
+// written every keyframe_interval ticks, so seeking only re-executes the ticks since the nearest keyframe.
+
+#ifndef TETRIS_REPLAY_H_
+#define TETRIS_REPLAY_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "game.h"
+#include "generator.h"
+
+struct ReplayHeader {
+  uint64_t seed;
+  PieceGenerator::Policy policy;
+  int level;
+  int width;
+  int height;
+  int keyframe_interval;
+};
+
+// Appends the events of one game to a replay file through an in-memory buffer, so that recording costs no system
+// calls during play. The buffer is written when it fills, on End() and when the writer is destroyed.
+class ReplayWriter {
+ public:
+  ReplayWriter(const char* path, const ReplayHeader& header);
+  ~ReplayWriter();
+
+  // Whether the file could be opened and all writes so far succeeded.
+  bool ok() const { return file_ && !failed_; }
+
+  void Input(const Game& game, Game::Input input);
+  void Pause(const Game& game);
+  // Called after each Game::Tick(), writing a keyframe when one is due.
+  void Tick(const Game& game);
+  // Records the final state and writes out the buffer. Nothing is recorded after the end.
+  void End(const Game& game);
+
+ private:
+  void Event(uint64_t tick, int kind);
+  void Flush();
+
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  FILE* file_;
+  bool failed_;
+  bool ended_;
+  const int keyframe_interval_;
+  uint64_t last_tick_;
+  std::vector<uint8_t> buffer_;
+  std::vector<uint8_t> state_;
+};
+
+// A replay file read into memory, with the position of every keyframe found when it is loaded.
+class Replay {
+ public:
+  // Reads and indexes a replay. Returns false and sets error if the file cannot be read or is malformed.
+  bool Load(const char* path, std::string* error);
+
+  const ReplayHeader& header() const { return header_; }
+  // The tick of the end event, or of the last event when the recording was cut short.
+  uint64_t last_tick() const { return last_tick_; }
+  bool has_end() const { return has_end_; }
+
+  // Re-executes the replay up to and including the events at tick, starting from the nearest keyframe at or before
+  // it. Keyframes passed along the way are compared with the re-executed game. Returns nullptr and sets error if
+  // the game diverges from the recording.
+  std::unique_ptr<Game> Seek(uint64_t tick, std::string* error) const;
+
+  // Re-executes the whole replay from the start, checking every keyframe and the end event.
+  std::unique_ptr<Game> Verify(std::string* error) const;
+
+ private:
+  struct Keyframe {
+    uint64_t tick;
+    // Offsets of the state and of the event after the keyframe.
+    size_t state;
+    size_t size;
+    size_t next;
+  };
+
+  std::unique_ptr<Game> Run(uint64_t tick, bool from_keyframe, std::string* error) const;
+
+  ReplayHeader header_;
+  std::vector<uint8_t> data_;
+  size_t events_;
+  std::vector<Keyframe> keyframes_;
+  uint64_t last_tick_;
+  bool has_end_;
+};
+
+#endif  // TETRIS_REPLAY_H_
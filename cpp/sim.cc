@@ -0,0 +1,419 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Runs many headless tetris games across all cores with a move policy and reports throughput, or verifies recorded
+// replays at full speed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "batch.h"
+#include "game.h"
+#include "policy.h"
+#include "replay.h"
+#include "spectate.h"
+#include "tick_clock.h"
+#include "versus.h"
+
+struct GameResult {
+  uint64_t seed;
+  int lines;
+  int pieces;
+  uint64_t ticks;
+};
+
+// Each worker owns a contiguous range of game indices and takes games from the front of it. A worker that runs out
+// steals from the front of another worker's range. Claims are a fetch_add on the range's next index, so a claim
+// past the end of a range simply fails and no locks are needed.
+struct alignas(64) WorkRange {
+  std::atomic<int> next;
+  int end;
+};
+
+struct SimOptions {
+  int games = 1000;
+  int threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t seed = 1;
+  PieceGenerator::Policy pieces = PieceGenerator::Policy::UNIFORM;
+  int level = 0;
+  int max_pieces = 100000;
+  // The board size, as WIDTHxHEIGHT, of games played and broadcast.
+  int width = 10;
+  int height = 20;
+  std::string policy = "drop";
+  bool verbose = false;
+  bool replays = false;
+  // With replays, the tick to seek to and print instead of verifying, or -1.
+  long seek = -1;
+  // For a versus match, the local port and the peer's host and port, as port:host:port.
+  std::string versus;
+  // The port to broadcast one game on in real time, or 0.
+  int broadcast = 0;
+  // Plays the drop policy's games in lockstep batches on BoardBatch kernels.
+  bool lockstep = false;
+};
+
+// Splits count items into one range per thread.
+std::vector<WorkRange> SplitWork(const int count, const int threads) {
+  std::vector<WorkRange> ranges(threads);
+  for (int t = 0; t < threads; ++t) {
+    ranges[t].next = static_cast<long>(count) * t / threads;
+    ranges[t].end = static_cast<long>(count) * (t + 1) / threads;
+  }
+  return ranges;
+}
+
+// Calls run(i) for every item, starting with the range of worker id and then stealing from the others.
+template <typename Run>
+void StealWork(const int id, std::vector<WorkRange>* ranges, Run run) {
+  const int num_ranges = ranges->size();
+  for (int victim = 0; victim < num_ranges; ++victim) {
+    WorkRange& range = (*ranges)[(id + victim) % num_ranges];
+    for (int i; (i = range.next.fetch_add(1, std::memory_order_relaxed)) < range.end;) {
+      run(i);
+    }
+  }
+}
+
+GameResult RunGame(const SimOptions& options, const uint64_t seed, Policy* policy) {
+  Game game(options.level, options.width, options.height, PieceGenerator(seed, options.pieces));
+  policy->Reset(seed);
+  game.AddBoardPiece();
+  while (!game.IsGameOver() && (options.max_pieces == 0 || game.pieces() <= options.max_pieces)) {
+    policy->Play(&game);
+    game.Tick();
+  }
+  return GameResult{.seed=seed, .lines=game.completed_lines(), .pieces=game.pieces(), .ticks=game.game_ticks()};
+}
+
+void Worker(const SimOptions& options, const int id, std::vector<WorkRange>* ranges, std::vector<GameResult>* results) {
+  std::unique_ptr<Policy> policy = MakePolicy(options.policy);
+  StealWork(id, ranges, [&](const int i) { (*results)[i] = RunGame(options, options.seed + i, policy.get()); });
+}
+
+// Games a lockstep worker plays at once.
+const int LOCKSTEP_BATCH = 1024;
+
+// Plays batch i of LOCKSTEP_BATCH games in lockstep, for each range claimed. The games end as RunGame() with the drop
+// policy ends them, but without ticks, which are left at 0.
+void LockstepWorker(const SimOptions& options, const int id, std::vector<WorkRange>* ranges,
+                    std::vector<GameResult>* results) {
+  StealWork(id, ranges, [&](const int i) {
+    const int first = i * LOCKSTEP_BATCH;
+    const int count = std::min<int>(LOCKSTEP_BATCH, results->size() - first);
+    std::vector<PieceGenerator> generators;
+    for (int g = 0; g < count; ++g) {
+      generators.emplace_back(options.seed + first + g, options.pieces);
+    }
+    DropBatch batch(options.level, options.width, options.height, generators);
+    while (batch.Step(options.max_pieces) > 0) {
+    }
+    for (int g = 0; g < count; ++g) {
+      (*results)[first + g] = GameResult{.seed=options.seed + first + g, .lines=batch.lines(g),
+                                         .pieces=batch.pieces(g), .ticks=0};
+    }
+  });
+}
+
+void PrintBoard(const Game& game) {
+  Coords piece;
+  game.CurrentCoords(piece);
+  for (int y = 0; y < game.height(); ++y) {
+    putchar('|');
+    for (int x = 0; x < game.width(); ++x) {
+      bool current = false;
+      for (const auto& [px, py] : piece) {
+        current |= !game.IsGameOver() && px == x && py == y;
+      }
+      putchar(current ? '@' : game.board().Occupied(x, y) ? '#' : ' ');
+    }
+    puts("|");
+  }
+  printf("tick %lu lines %d pieces %d level %d next %d%s\n", game.game_ticks(), game.completed_lines(),
+         game.pieces(), game.level(), game.next_piece(),
+         game.IsGameOver() ? " game over" : game.status() == Game::Status::PAUSE ? " paused" : "");
+}
+
+// Re-executes each replay in parallel, checking it against its keyframes and final state, or seeks each to a tick
+// and prints its board.
+int RunReplays(const SimOptions& options, const std::vector<const char*>& paths) {
+  struct ReplayResult {
+    std::string error;
+    std::unique_ptr<Game> game;
+    uint64_t ticks;
+  };
+  std::vector<ReplayResult> results(paths.size());
+  const int threads = std::min<int>(options.threads, paths.size());
+  std::vector<WorkRange> ranges = SplitWork(paths.size(), threads);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      StealWork(t, &ranges, [&](const int i) {
+        Replay replay;
+        ReplayResult& result = results[i];
+        if (!replay.Load(paths[i], &result.error)) {
+          return;
+        }
+        result.game = options.seek < 0 ? replay.Verify(&result.error) : replay.Seek(options.seek, &result.error);
+        result.ticks = result.game ? result.game->game_ticks() : 0;
+      });
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int failed = 0;
+  uint64_t total_ticks = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const ReplayResult& result = results[i];
+    if (!result.game) {
+      ++failed;
+      printf("%s: %s\n", paths[i], result.error.c_str());
+      continue;
+    }
+    total_ticks += result.ticks;
+    if (options.seek >= 0) {
+      printf("%s:\n", paths[i]);
+      PrintBoard(*result.game);
+    } else if (options.verbose) {
+      printf("%s: ok, lines %d pieces %d ticks %lu\n", paths[i], result.game->completed_lines(),
+             result.game->pieces(), result.ticks);
+    }
+  }
+  printf("%zu replays, %d failed, on %d threads in %.3f s (%.0f ticks/sec)\n", paths.size(), failed, threads,
+         seconds, total_ticks / seconds);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Plays one versus match in real time against another tetris-sim or tetris, pressing random keys like the random
+// policy, and prints the result and how the rollbacks went.
+int RunVersus(const SimOptions& options) {
+  char host[256];
+  int port, peer_port;
+  if (sscanf(options.versus.c_str(), "%d:%255[^:]:%d", &port, host, &peer_port) != 3) {
+    std::cerr << "-V takes port:host:port, e.g. 7001:localhost:7002" << std::endl;
+    return EXIT_FAILURE;
+  }
+  VersusLink link;
+  std::string error;
+  VersusSettings settings = {.seed=options.seed, .pieces=options.pieces, .level=options.level};
+  int player;
+  if (!link.Open(port, host, peer_port, &error) || !link.Handshake(&settings, &player, 60000, &error)) {
+    std::cerr << "Versus: " << error << std::endl;
+    return EXIT_FAILURE;
+  }
+  printf("Player %d of a match with seed %lu\n", player + 1, settings.seed);
+  RollbackSession session(Match(settings.level, 10, 20, PieceGenerator(settings.seed, settings.pieces)), player);
+  Pcg32 random(options.seed, 2 + player);
+  TickClock clock(60);
+  // After the end, keep sending until the peer has every frame, so that it sees the same end.
+  auto end = std::chrono::steady_clock::time_point::max();
+  while (std::chrono::steady_clock::now() < end &&
+         (!session.confirmed().IsOver() || session.acked() + 1 < session.present())) {
+    if (std::chrono::steady_clock::now() - link.last_received() > std::chrono::seconds(5)) {
+      std::cerr << "Versus: the peer stopped answering" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::this_thread::sleep_until(clock.Next());
+    for (int due = clock.Due(); due > 0; --due) {
+      link.Receive(&session);
+      session.Reconcile();
+      if (session.ShouldAdvance()) {
+        const int choice = random.Below(Game::Input::ROTATE + 2);
+        if (choice <= Game::Input::ROTATE) {
+          session.Input(static_cast<Game::Input>(choice));
+        }
+        session.Advance();
+      }
+      link.Send(session);
+    }
+    if (session.confirmed().IsOver() && end == std::chrono::steady_clock::time_point::max()) {
+      end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    }
+  }
+  const Match& match = session.confirmed();
+  const int winner = match.winner();
+  printf("%s after %lu frames, lines %d to %d\n", winner < 0 ? "Draw" : winner == player ? "Won" : "Lost",
+         match.frames(), match.game(player).completed_lines(), match.game(1 - player).completed_lines());
+  PrintRollbackStats(session.stats());
+  return EXIT_SUCCESS;
+}
+
+// Plays one game in real time with the policy, streaming it to spectators, and prints what was sent to them.
+int RunBroadcast(const SimOptions& options) {
+  std::unique_ptr<Policy> policy = MakePolicy(options.policy);
+  SpectatorServer server;
+  std::string error;
+  if (!policy || !server.Start(options.broadcast, &error)) {
+    std::cerr << "Broadcast: " << (policy ? error : "no policy " + options.policy) << std::endl;
+    return EXIT_FAILURE;
+  }
+  Game game(options.level, options.width, options.height, PieceGenerator(options.seed, options.pieces));
+  policy->Reset(options.seed);
+  game.AddBoardPiece();
+  GameView view;
+  TickClock clock(60);
+  while (!game.IsGameOver() && (options.max_pieces == 0 || game.pieces() <= options.max_pieces)) {
+    std::this_thread::sleep_until(clock.Next());
+    for (int due = clock.Due(); due > 0 && !game.IsGameOver(); --due) {
+      policy->Play(&game);
+      game.Tick();
+    }
+    view.From(game);
+    server.Publish(view);
+  }
+  // Give the spectators a moment to receive the end.
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  server.Stop();
+  printf("seed %lu lines %d pieces %d ticks %lu\n", options.seed, game.completed_lines(), game.pieces(),
+         game.game_ticks());
+  server.PrintStats();
+  return EXIT_SUCCESS;
+}
+
+void Usage(const char* const argv0) {
+  std::cerr << "usage: " << argv0 << " [-n games] [-j threads] [-s first seed] [-b] [-l level]"
+            << " [-m max pieces per game] [-p policy] [-W WIDTHxHEIGHT] [-L] [-v]\n"
+            << "       " << argv0 << " -R [-j threads] [-S tick] [-v] replay...\n"
+            << "       " << argv0 << " -V port:host:port [-s seed] [-b] [-l level]\n"
+            << "       " << argv0 << " -B port [-s seed] [-b] [-l level] [-m max pieces] [-p policy]"
+            << " [-W WIDTHxHEIGHT]\n\n"
+            << "  Policies: " << POLICY_NAMES << "\n"
+            << "  -b deals pieces from shuffled bags of all 7 instead of uniformly at random.\n"
+            << "  -m 0 plays each game until it is over. -v prints the result of every game.\n"
+            << "  -W plays on a board of that many columns by rows (10x20), up to 4096 columns and 64M cells.\n"
+            << "  -R verifies games recorded by tetris, or with -S prints their boards at a tick.\n"
+            << "  -V plays a versus match against the peer at host:port, listening on port, pressing random keys.\n"
+            << "  -B plays one game in real time and streams it to tetris-watch spectators on port.\n"
+            << "  -L plays the drop policy's games " << LOCKSTEP_BATCH << " at a time in lockstep with the "
+            << BoardBatch::InstructionSet() << " batch kernels, on boards up to " << BoardBatch::MAX_WIDTH
+            << " columns. Ticks are not counted.\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+  SimOptions options;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:j:s:bl:m:p:vRS:V:B:W:L")) != -1) {
+    switch (opt) {
+      case 'n':
+        options.games = strtol(optarg, nullptr, 0);
+        break;
+      case 'j':
+        options.threads = strtol(optarg, nullptr, 0);
+        break;
+      case 's':
+        options.seed = strtoull(optarg, nullptr, 0);
+        break;
+      case 'b':
+        options.pieces = PieceGenerator::Policy::BAG;
+        break;
+      case 'l':
+        options.level = strtol(optarg, nullptr, 0);
+        break;
+      case 'm':
+        options.max_pieces = strtol(optarg, nullptr, 0);
+        break;
+      case 'p':
+        options.policy = optarg;
+        break;
+      case 'v':
+        options.verbose = true;
+        break;
+      case 'R':
+        options.replays = true;
+        break;
+      case 'S':
+        options.seek = strtol(optarg, nullptr, 0);
+        break;
+      case 'V':
+        options.versus = optarg;
+        break;
+      case 'B':
+        options.broadcast = strtol(optarg, nullptr, 0);
+        break;
+      case 'L':
+        options.lockstep = true;
+        break;
+      case 'W':
+        if (sscanf(optarg, "%dx%d", &options.width, &options.height) != 2 || options.width < 1 ||
+            options.width > Board::MAX_WIDTH || options.height < 1 ||
+            static_cast<long>(options.width)*options.height > Board::MAX_CELLS) {
+          Usage(*argv);
+        }
+        break;
+      default:
+        Usage(*argv);
+    }
+  }
+  if (!options.versus.empty()) {
+    return RunVersus(options);
+  }
+  if (options.broadcast) {
+    return RunBroadcast(options);
+  }
+  if (options.replays) {
+    if (optind == argc || options.threads < 1) {
+      Usage(*argv);
+    }
+    return RunReplays(options, std::vector<const char*>(argv + optind, argv + argc));
+  }
+  if (options.games < 1 || options.threads < 1 || options.max_pieces < 0 || !MakePolicy(options.policy) ||
+      (options.lockstep && (options.policy != "drop" || options.width > BoardBatch::MAX_WIDTH))) {
+    Usage(*argv);
+  }
+  // Lockstep workers take whole batches of games.
+  const int units = options.lockstep ? (options.games + LOCKSTEP_BATCH - 1) / LOCKSTEP_BATCH : options.games;
+  options.threads = std::min(options.threads, units);
+
+  std::vector<WorkRange> ranges = SplitWork(units, options.threads);
+  std::vector<GameResult> results(options.games);
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < options.threads; ++t) {
+    workers.emplace_back(options.lockstep ? LockstepWorker : Worker, std::cref(options), t, &ranges, &results);
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  long total_pieces = 0;
+  long total_lines = 0;
+  uint64_t total_ticks = 0;
+  int max_lines = 0;
+  for (const GameResult& result : results) {
+    if (options.verbose) {
+      printf("seed %lu lines %d pieces %d ticks %lu\n", result.seed, result.lines, result.pieces, result.ticks);
+    }
+    total_pieces += result.pieces;
+    total_lines += result.lines;
+    total_ticks += result.ticks;
+    max_lines = std::max(max_lines, result.lines);
+  }
+  printf("policy %s, %d games on %d threads%s in %.3f s\n", options.policy.c_str(), options.games, options.threads,
+         options.lockstep ? " in lockstep" : "", seconds);
+  if (options.lockstep) {
+    printf("  %.0f pieces/sec, %.1f games/sec\n", total_pieces / seconds, options.games / seconds);
+  } else {
+    printf("  %.0f pieces/sec, %.1f games/sec, %.0f ticks/sec\n", total_pieces / seconds, options.games / seconds,
+           total_ticks / seconds);
+  }
+  printf("  lines: mean %.2f, max %d; pieces: mean %.1f\n", static_cast<double>(total_lines) / options.games,
+         max_lines, static_cast<double>(total_pieces) / options.games);
+  return EXIT_SUCCESS;
+}
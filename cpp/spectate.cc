@@ -0,0 +1,536 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Streaming a live game to spectators over TCP.
+
+#include "spectate.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "varint.h"
+
+namespace {
+
+enum Kind {KEYFRAME, DELTA};
+
+// Messages sent with one system call, at most.
+const int MAX_IOVECS = 64;
+
+}  // namespace
+
+void GameView::From(const Game& game) {
+  const Board& board = game.board();
+  const int board_top = board.Top();
+  changed.clear();
+  const bool full = updates == 0 || width != game.width() || height != game.height();
+  if (full) {
+    width = game.width();
+    height = game.height();
+    cells.resize(width*height);
+    game.Render(cells.data());
+    changed.emplace_back(0, height - 1);
+  } else {
+    // The rows the piece and its ghost were drawn in, and the rows of either stack that differ from the board,
+    // which the old piece and ghost rows do too.
+    for (const auto& [first, last] : {piece_rows, ghost_rows}) {
+      if (first <= last) {
+        changed.emplace_back(first, last);
+      }
+    }
+    for (int y = std::min(board_top_, board_top); y < height; ++y) {
+      if (memcmp(&cells[y*width], board.Colors(y), width)) {
+        if (!changed.empty() && changed.back().second == y - 1) {
+          changed.back().second = y;
+        } else {
+          changed.emplace_back(y, y);
+        }
+      }
+    }
+  }
+  piece_rows = ghost_rows = {0, -1};
+  if (!game.IsGameOver()) {
+    Coords coords;
+    game.CurrentCoords(coords);
+    int first = height;
+    int last = -1;
+    for (const auto& [x, y] : coords) {
+      first = std::min(first, y);
+      last = std::max(last, y);
+    }
+    const int drop = game.DropDistance();
+    piece_rows = {first, last};
+    ghost_rows = {first + drop, last + drop};
+    changed.push_back(piece_rows);
+    changed.push_back(ghost_rows);
+  }
+  // Merged into ranges apart, each rendered again in one go.
+  std::sort(changed.begin(), changed.end());
+  size_t merged = 0;
+  for (size_t i = 1; i < changed.size(); ++i) {
+    if (changed[i].first <= changed[merged].second + 1) {
+      changed[merged].second = std::max(changed[merged].second, changed[i].second);
+    } else {
+      changed[++merged] = changed[i];
+    }
+  }
+  changed.resize(std::min(changed.size(), merged + 1));
+  if (!full) {
+    for (const auto& [first, last] : changed) {
+      game.Render(0, first, width, last - first + 1, &cells[first*width]);
+    }
+  }
+  board_top_ = board_top;
+  top = std::min(board_top, ghost_rows.first <= ghost_rows.second ? ghost_rows.first : height);
+  ++updates;
+  tick = game.game_ticks();
+  lines = game.completed_lines();
+  level = game.level();
+  next_piece = game.next_piece();
+  game_over = game.IsGameOver();
+}
+
+SpectatorServer::SpectatorServer()
+ : listen_fd_(-1),
+   wake_fd_(-1),
+   epoll_fd_(-1),
+   keyframe_tick_(0),
+   keyframed_(false),
+   quit_(false),
+   backlog_bytes_(0),
+   keyframes_(0),
+   keyframe_bytes_(0),
+   deltas_published_(0),
+   delta_bytes_(0),
+   peak_spectators_(0),
+   bytes_sent_(0),
+   resyncs_(0) {
+}
+
+SpectatorServer::~SpectatorServer() {
+  Stop();
+}
+
+bool SpectatorServer::Start(const int port, std::string* const error) {
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  const int on = 1;
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (listen_fd_ < 0 || setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+      bind(listen_fd_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) || listen(listen_fd_, 128)) {
+    *error = std::string("port ") + std::to_string(port) + ": " + strerror(errno);
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event listen_event = {.events=EPOLLIN, .data={.fd=listen_fd_}};
+  struct epoll_event wake_event = {.events=EPOLLIN, .data={.fd=wake_fd_}};
+  if (wake_fd_ < 0 || epoll_fd_ < 0 || epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &listen_event) ||
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &wake_event)) {
+    *error = std::string("epoll: ") + strerror(errno);
+    return false;
+  }
+  thread_ = std::thread(&SpectatorServer::Run, this);
+  return true;
+}
+
+void SpectatorServer::Stop() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    const uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+      perror("SpectatorServer: eventfd");
+    }
+    thread_.join();
+  }
+  for (const int fd : {listen_fd_, wake_fd_, epoll_fd_}) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  listen_fd_ = wake_fd_ = epoll_fd_ = -1;
+}
+
+void SpectatorServer::Publish(const GameView& view) {
+  // Only a view brought up to date from the last one published says which rows changed.
+  const bool follows = keyframed_ && view.updates == last_.updates + 1 && view.width == last_.width &&
+                       view.height == last_.height;
+  const bool keyframe = !follows || view.tick >= keyframe_tick_ + KEYFRAME_INTERVAL;
+  int changes = 0;
+  if (follows) {
+    for (const auto& [first, last] : view.changed) {
+      for (int i = first*view.width; i < (last + 1)*view.width; ++i) {
+        changes += view.cells[i] != last_.cells[i];
+      }
+    }
+  }
+  last_.updates = view.updates;
+  last_.tick = view.tick;
+  if (!keyframe && !changes && view.lines == last_.lines && view.level == last_.level &&
+      view.next_piece == last_.next_piece && view.game_over == last_.game_over) {
+    return;
+  }
+  encoded_.clear();
+  if (keyframe) {
+    PutVarint(&encoded_, KEYFRAME);
+    PutVarint(&encoded_, view.tick);
+    PutVarint(&encoded_, view.width);
+    PutVarint(&encoded_, view.height);
+    PutVarint(&encoded_, view.lines);
+    PutVarint(&encoded_, view.level);
+    PutVarint(&encoded_, view.next_piece);
+    PutVarint(&encoded_, view.game_over);
+    PutVarint(&encoded_, view.top);
+    // The piece may be above the top, anywhere from the top of the board.
+    const int above = std::min(view.piece_rows.second + 1, view.top)*view.width;
+    int count = 0;
+    for (int i = view.piece_rows.first*view.width; i < above; ++i) {
+      count += view.cells[i] != 0;
+    }
+    PutVarint(&encoded_, count);
+    for (int i = view.piece_rows.first*view.width, next = 0; i < above; ++i) {
+      if (view.cells[i]) {
+        PutVarint(&encoded_, i - next);
+        encoded_.push_back(view.cells[i]);
+        next = i + 1;
+      }
+    }
+    const int cells = view.width*view.height;
+    for (int i = view.top*view.width; i < cells; i += 2) {
+      encoded_.push_back(view.cells[i] | (i + 1 < cells ? view.cells[i + 1] << 4 : 0));
+    }
+    keyframe_tick_ = view.tick;
+    keyframed_ = true;
+  } else {
+    PutVarint(&encoded_, DELTA);
+    PutVarint(&encoded_, view.tick);
+    PutVarint(&encoded_, view.lines);
+    PutVarint(&encoded_, view.level);
+    PutVarint(&encoded_, view.next_piece);
+    PutVarint(&encoded_, view.game_over);
+    PutVarint(&encoded_, changes);
+    int next = 0;
+    for (const auto& [first, last] : view.changed) {
+      for (int i = first*view.width; i < (last + 1)*view.width; ++i) {
+        if (view.cells[i] != last_.cells[i]) {
+          PutVarint(&encoded_, i - next);
+          encoded_.push_back(view.cells[i]);
+          next = i + 1;
+        }
+      }
+    }
+  }
+  if (follows) {
+    for (const auto& [first, last] : view.changed) {
+      std::copy(view.cells.data() + first*view.width, view.cells.data() + (last + 1)*view.width,
+                last_.cells.data() + first*view.width);
+    }
+  } else {
+    last_.width = view.width;
+    last_.height = view.height;
+    last_.cells.assign(view.cells.begin(), view.cells.end());
+  }
+  last_.lines = view.lines;
+  last_.level = view.level;
+  last_.next_piece = view.next_piece;
+  last_.game_over = view.game_over;
+
+  auto message = std::make_shared<std::vector<uint8_t>>();
+  message->reserve(encoded_.size() + 4);
+  PutVarint(message.get(), encoded_.size());
+  message->insert(message->end(), encoded_.begin(), encoded_.end());
+  if (keyframe) {
+    ++keyframes_;
+    keyframe_bytes_ += message->size();
+  } else {
+    ++deltas_published_;
+    delta_bytes_ += message->size();
+  }
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The server thread takes every message published since it was last woken, so one wake covers them all.
+    wake = published_.empty();
+    published_.push_back(Published{.message=message, .keyframe=keyframe});
+  }
+  const uint64_t one = 1;
+  if (wake && write(wake_fd_, &one, sizeof(one)) < 0) {
+    perror("SpectatorServer: eventfd");
+  }
+}
+
+void SpectatorServer::Run() {
+  struct epoll_event events[64];
+  std::vector<Published> published;
+  std::vector<int> closed;
+  for (;;) {
+    const int count = epoll_wait(epoll_fd_, events, 64, -1);
+    if (count < 0 && errno != EINTR) {
+      perror("SpectatorServer: epoll_wait");
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == listen_fd_) {
+        Accept();
+      } else if (fd == wake_fd_) {
+        uint64_t value;
+        if (read(wake_fd_, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+          perror("SpectatorServer: eventfd");
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (quit_) {
+            for (const auto& [spectator_fd, spectator] : spectators_) {
+              close(spectator_fd);
+            }
+            spectators_.clear();
+            return;
+          }
+          published.swap(published_);
+        }
+        for (const Published& p : published) {
+          if (p.keyframe) {
+            keyframe_ = p.message;
+            deltas_.clear();
+            backlog_bytes_ = 0;
+          } else {
+            deltas_.push_back(p.message);
+          }
+          backlog_bytes_ += p.message->size();
+          for (auto& [spectator_fd, spectator] : spectators_) {
+            Queue(&spectator, p.message);
+          }
+        }
+        published.clear();
+        for (auto& [spectator_fd, spectator] : spectators_) {
+          if (!spectator.waiting && !Flush(spectator_fd, &spectator)) {
+            closed.push_back(spectator_fd);
+          }
+        }
+      } else {
+        auto it = spectators_.find(fd);
+        if (it == spectators_.end()) {
+          continue;
+        }
+        bool open = !(events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP));
+        if (open && (events[i].events & EPOLLIN)) {
+          // Spectators have nothing to say, so anything read is dropped, and reading nothing means they left.
+          char discard[256];
+          const ssize_t size = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+          open = size > 0 || (size < 0 && (errno == EAGAIN || errno == EINTR));
+        }
+        if (open && (events[i].events & EPOLLOUT)) {
+          open = Flush(fd, &it->second);
+        }
+        if (!open) {
+          closed.push_back(fd);
+        }
+      }
+    }
+    for (const int fd : closed) {
+      Close(fd);
+    }
+    closed.clear();
+  }
+}
+
+void SpectatorServer::Accept() {
+  int fd;
+  while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    // Deltas are small and due at once, so they are not held back to be coalesced.
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct epoll_event event = {.events=EPOLLIN | EPOLLRDHUP, .data={.fd=fd}};
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event)) {
+      close(fd);
+      continue;
+    }
+    Spectator& spectator = spectators_[fd];
+    spectator = Spectator{.queue={}, .sent=0, .queued=0, .waiting=false};
+    peak_spectators_ = std::max(peak_spectators_, spectators_.size());
+    // A spectator that joins late starts from the last keyframe.
+    if (keyframe_) {
+      QueueBacklog(&spectator);
+      if (!Flush(fd, &spectator)) {
+        Close(fd);
+      }
+    }
+  }
+}
+
+void SpectatorServer::Queue(Spectator* const spectator, const Message& message) {
+  // A spectator is only behind when it has more queued than a late joiner is sent, or it would be sent the same
+  // backlog again and again once keyframes are big.
+  if (spectator->queued > MAX_QUEUED + backlog_bytes_ && keyframe_) {
+    // The spectator cannot keep up. What it has not started receiving is replaced by the last keyframe and the
+    // deltas since, which end with this message.
+    ++resyncs_;
+    while (spectator->queue.size() > (spectator->sent ? 1 : 0)) {
+      spectator->queue.pop_back();
+    }
+    spectator->queued = spectator->queue.empty() ? 0 : spectator->queue.front()->size() - spectator->sent;
+    QueueBacklog(spectator);
+    return;
+  }
+  spectator->queue.push_back(message);
+  spectator->queued += message->size();
+}
+
+void SpectatorServer::QueueBacklog(Spectator* const spectator) {
+  spectator->queue.push_back(keyframe_);
+  spectator->queue.insert(spectator->queue.end(), deltas_.begin(), deltas_.end());
+  spectator->queued += backlog_bytes_;
+}
+
+bool SpectatorServer::Flush(const int fd, Spectator* const spectator) {
+  while (!spectator->queue.empty()) {
+    struct iovec iovecs[MAX_IOVECS];
+    int count = 0;
+    for (auto it = spectator->queue.begin(); it != spectator->queue.end() && count < MAX_IOVECS; ++it, ++count) {
+      const size_t skip = count ? 0 : spectator->sent;
+      iovecs[count].iov_base = const_cast<uint8_t*>((*it)->data()) + skip;
+      iovecs[count].iov_len = (*it)->size() - skip;
+    }
+    struct msghdr header = {};
+    header.msg_iov = iovecs;
+    header.msg_iovlen = count;
+    ssize_t sent = sendmsg(fd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN) {
+        return false;
+      }
+      // The socket is full, so the rest waits for it to drain.
+      if (!spectator->waiting) {
+        struct epoll_event event = {.events=EPOLLIN | EPOLLOUT | EPOLLRDHUP, .data={.fd=fd}};
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+        spectator->waiting = true;
+      }
+      return true;
+    }
+    bytes_sent_ += sent;
+    spectator->queued -= sent;
+    while (sent > 0) {
+      const size_t left = spectator->queue.front()->size() - spectator->sent;
+      if (static_cast<size_t>(sent) < left) {
+        spectator->sent += sent;
+        break;
+      }
+      sent -= left;
+      spectator->sent = 0;
+      spectator->queue.pop_front();
+    }
+  }
+  if (spectator->waiting) {
+    struct epoll_event event = {.events=EPOLLIN | EPOLLRDHUP, .data={.fd=fd}};
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event);
+    spectator->waiting = false;
+  }
+  return true;
+}
+
+void SpectatorServer::Close(const int fd) {
+  // Closing the socket also removes it from the epoll set.
+  close(fd);
+  spectators_.erase(fd);
+}
+
+void SpectatorServer::PrintStats() const {
+  printf("Spectators: %zu at most, %lu bytes sent, %lu resynchronized after falling behind\n", peak_spectators_,
+         bytes_sent_, resyncs_);
+  printf("Published %lu keyframes of %.0f bytes and %lu deltas of %.1f bytes on average\n", keyframes_,
+         keyframes_ ? static_cast<double>(keyframe_bytes_)/keyframes_ : 0, deltas_published_,
+         deltas_published_ ? static_cast<double>(delta_bytes_)/deltas_published_ : 0);
+}
+
+bool ViewDecoder::Apply(const uint8_t* data, const size_t size) {
+  const uint8_t* const end = data + size;
+  uint64_t kind, tick, lines, level, next_piece, game_over;
+  if (!GetVarint(&data, end, &kind) || !GetVarint(&data, end, &tick)) {
+    return false;
+  }
+  if (kind == KEYFRAME) {
+    uint64_t width, height;
+    if (!GetVarint(&data, end, &width) || !GetVarint(&data, end, &height) || width < 1 ||
+        width > Board::MAX_WIDTH || height < 1 || height > Board::MAX_CELLS || width*height > Board::MAX_CELLS) {
+      return false;
+    }
+    const int cells = width*height;
+    uint64_t top, count;
+    if (!GetVarint(&data, end, &lines) || !GetVarint(&data, end, &level) || !GetVarint(&data, end, &next_piece) ||
+        !GetVarint(&data, end, &game_over) || !GetVarint(&data, end, &top) || top > height ||
+        !GetVarint(&data, end, &count)) {
+      return false;
+    }
+    // Only the rows above the new top that were not already empty are cleared.
+    if (!ready_ || view_.width != static_cast<int>(width) || view_.height != static_cast<int>(height)) {
+      view_.width = width;
+      view_.height = height;
+      view_.cells.assign(cells, 0);
+    } else if (view_.top < static_cast<int>(top)) {
+      std::fill(view_.cells.data() + view_.top*width, view_.cells.data() + top*width, 0);
+    }
+    view_.top = top;
+    uint64_t cell = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t skip;
+      if (!GetVarint(&data, end, &skip) || data == end || (cell += skip) >= top*width) {
+        return false;
+      }
+      view_.cells[cell] = *data++ & 0xf;
+      view_.top = std::min<int>(view_.top, cell / width);
+      ++cell;
+    }
+    if (end - data != (cells - static_cast<int>(top*width) + 1) / 2) {
+      return false;
+    }
+    uint8_t* const rows = view_.cells.data() + top*width;
+    for (int i = 0; i < cells - static_cast<int>(top*width); ++i) {
+      rows[i] = (data[i / 2] >> (i % 2 * 4)) & 0xf;
+    }
+    ready_ = true;
+  } else if (kind == DELTA && ready_) {
+    uint64_t changes;
+    if (!GetVarint(&data, end, &lines) || !GetVarint(&data, end, &level) || !GetVarint(&data, end, &next_piece) ||
+        !GetVarint(&data, end, &game_over) || !GetVarint(&data, end, &changes)) {
+      return false;
+    }
+    uint64_t cell = 0;
+    for (uint64_t i = 0; i < changes; ++i) {
+      uint64_t skip;
+      if (!GetVarint(&data, end, &skip) || data == end || (cell += skip) >= view_.cells.size()) {
+        return false;
+      }
+      view_.cells[cell] = *data++ & 0xf;
+      if (view_.cells[cell] && static_cast<int>(cell) < view_.top*view_.width) {
+        view_.top = cell / view_.width;
+      }
+      ++cell;
+    }
+  } else {
+    return false;
+  }
+  view_.tick = tick;
+  view_.lines = lines;
+  view_.level = level;
+  view_.next_piece = next_piece;
+  view_.game_over = game_over;
+  return true;
+}
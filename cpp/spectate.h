@@ -0,0 +1,179 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Streaming a live game to spectators over TCP.
+//
+// The stream is a sequence of messages, each a varint of its size followed by the message, whose first varint is
+// its kind:
+//
+//   0  tick width height lines level next_piece game_over top     A keyframe: the cells above row top that are not
+//      count changes cells                                          empty, which are only the falling piece's, as a
+//                                                                     delta gives them, then every cell from row top
+//                                                                     down, two per byte, low nibble first.
+//   1  tick lines level next_piece game_over count changes          A delta: count changed cells, each a varint of
+//                                                                     cells skipped since the last change, then
+//                                                                     a byte of its color.
+//
+// Cells are row by row, as Game::Render() fills them: a color 0-7, or'd with Game::GHOST for the ghost. A delta
+// applies to the view the keyframe and deltas before it give. Every stream starts with a keyframe.
+
+#ifndef TETRIS_SPECTATE_H_
+#define TETRIS_SPECTATE_H_
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "game.h"
+
+// What spectators see of a game.
+struct GameView {
+  explicit GameView(const int width=10, const int height=20)
+   : width(width), height(height), cells(width*height), top(height), piece_rows(0, -1), ghost_rows(0, -1),
+     changed(), updates(0), tick(0), lines(0), level(0), next_piece(1), game_over(false), board_top_(height) {
+  }
+
+  // Brings the view up to date with the game. Only the rows that can differ from the last view are rendered again:
+  // those the falling piece and its ghost were in and are in, and those of the stack whose colors differ from the
+  // board's, found with a memcmp() a row. Above the stack both boards are empty, so a lock or a clear costs the
+  // rows of the stack and a tick between them a few rows, however big the board.
+  void From(const Game& game);
+
+  int width;
+  int height;
+  std::vector<uint8_t> cells;
+  // The rows above top are empty but for the falling piece. Top is the top of the stack or of the ghost, so the
+  // rows from it down are about as many as the stack has.
+  int top;
+  // The first and last rows of the falling piece and of its ghost, or empty ranges once the game is over.
+  std::pair<int, int> piece_rows;
+  std::pair<int, int> ghost_rows;
+  // The rows the last From() rendered again, as ranges of first and last row, in order and apart.
+  std::vector<std::pair<int, int>> changed;
+  // How many times From() has brought the view up to date, so a publisher can tell whether a view is the next one.
+  uint64_t updates;
+  uint64_t tick;
+  int lines;
+  int level;
+  int next_piece;
+  bool game_over;
+
+ private:
+  // The top of the board's stack when the view was rendered.
+  int board_top_;
+};
+
+// Sends a game to any number of spectators, on a thread of its own that waits on every connection at once with
+// epoll. Each view published is encoded once, as the cells that changed, and the same bytes are queued to every
+// spectator, so the cost of a publish barely depends on how many are watching.
+//
+// A delta compares only the rows GameView::From() rendered again. A keyframe of every cell from the top of the
+// stack down is encoded every KEYFRAME_INTERVAL ticks. A spectator that joins late is sent the last keyframe and
+// the deltas since, and so is one that falls more than MAX_QUEUED bytes behind that backlog, in place of what it had
+// not yet been sent.
+class SpectatorServer {
+ public:
+  static const int KEYFRAME_INTERVAL = 120;
+  static const size_t MAX_QUEUED = 1 << 16;
+
+  SpectatorServer();
+  ~SpectatorServer();
+  SpectatorServer(const SpectatorServer&) = delete;
+  SpectatorServer& operator=(const SpectatorServer&) = delete;
+
+  // Listens on port and starts the thread. Returns false and sets error on failure.
+  bool Start(int port, std::string* error);
+
+  // Sends a view to every spectator. Called from one thread, which only encodes the view and hands it over.
+  void Publish(const GameView& view);
+
+  // Stops the thread and closes every connection. Called by the destructor if not before.
+  void Stop();
+
+  // Prints how many spectators there were and what was sent to them. Call after Stop().
+  void PrintStats() const;
+
+ private:
+  typedef std::shared_ptr<const std::vector<uint8_t>> Message;
+
+  struct Spectator {
+    // Messages not yet sent in full, and how much of the first was sent.
+    std::deque<Message> queue;
+    size_t sent;
+    size_t queued;
+    // Whether EPOLLOUT is enabled, for when the socket is full.
+    bool waiting;
+  };
+
+  // A message as published, and whether it is a keyframe.
+  struct Published {
+    Message message;
+    bool keyframe;
+  };
+
+  void Run();
+  void Accept();
+  void Queue(Spectator* spectator, const Message& message);
+  // Queues the last keyframe and the deltas since.
+  void QueueBacklog(Spectator* spectator);
+  // Sends what the socket takes of the queue. Returns false if the connection is gone.
+  bool Flush(int fd, Spectator* spectator);
+  void Close(int fd);
+
+  int listen_fd_;
+  int wake_fd_;
+  int epoll_fd_;
+  std::thread thread_;
+
+  // Used by the publishing thread: the last view published, and the message being encoded.
+  GameView last_;
+  uint64_t keyframe_tick_;
+  bool keyframed_;
+  std::vector<uint8_t> encoded_;
+
+  // Guarded by mutex_: messages published and not yet queued to spectators, and whether to stop.
+  std::mutex mutex_;
+  std::vector<Published> published_;
+  bool quit_;
+
+  // Used by the server thread: the last keyframe, the deltas since and their bytes, and each connection's spectator.
+  Message keyframe_;
+  std::vector<Message> deltas_;
+  size_t backlog_bytes_;
+  std::unordered_map<int, Spectator> spectators_;
+
+  // Counted by the publishing thread: keyframes and deltas encoded, and their bytes.
+  uint64_t keyframes_;
+  uint64_t keyframe_bytes_;
+  uint64_t deltas_published_;
+  uint64_t delta_bytes_;
+  // Counted by the server thread, and read once it stops: the most spectators at once, the bytes sent to all of
+  // them, and how many times one fell behind and was sent the last keyframe.
+  size_t peak_spectators_;
+  uint64_t bytes_sent_;
+  uint64_t resyncs_;
+};
+
+// A spectator's copy of a view, kept up to date from the stream.
+class ViewDecoder {
+ public:
+  ViewDecoder() : ready_(false) {}
+
+  // Applies one message, without its size. Returns false if it is not a valid message for the view so far.
+  bool Apply(const uint8_t* data, size_t size);
+
+  bool ready() const { return ready_; }
+  const GameView& view() const { return view_; }
+
+ private:
+  GameView view_;
+  bool ready_;
+};
+
+#endif  // TETRIS_SPECTATE_H_
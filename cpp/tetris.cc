@@ -4,12 +4,23 @@
 // A tetris game.
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <thread>
+#include <vector>
 #include <unistd.h>
 #include <sys/param.h>
 #include <SDL2/SDL.h>
@@ -17,10 +28,24 @@
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
 
-const int NUM_TETROMINOS = 7;
+#include "assets.h"
+#include "game.h"
+#include "latency.h"
+#include "profile.h"
+#include "replay.h"
+#include "spectate.h"
+#include "tick_clock.h"
+#include "triple_buffer.h"
+#include "versus.h"
 
-typedef int Coords[4][2];
-typedef int (*CoordsPtr)[2];
+#ifdef TETRIS_EMBED_ASSETS
+// The archive linked in by make EMBED_ASSETS=1.
+extern "C" const uint8_t _binary_tetris_assets_start[];
+extern "C" const uint8_t _binary_tetris_assets_end[];
+#endif
+
+// Ticks are frames, so at 60 frames per second replays have a keyframe for every 10 seconds of play.
+const int REPLAY_KEYFRAME_INTERVAL = 600;
 
 void CHECK_SDLI(int ret, const char* const msg, const char* (* const GetError)()) {
   if (ret < 0) {
@@ -36,529 +61,1326 @@ void CHECK_SDLP(void* ret, const char* const msg, const char* (* const GetError)
   }
 }
 
-// Starting position of each type of tetromino. Each tetromino is 4 (x,y) coordinates.
-const int starting_positions[NUM_TETROMINOS][4][2] = {
-  {{-1,0}, {-1,1}, {0,1}, {1,1}},  // Leftward L piece.
-  {{-1,1}, {0,1},  {0,0}, {1,0}},  // Rightward Z piece.
-  {{-2,0}, {-1,0}, {0,0}, {1,0}},  // Long straight piece.
-  {{-1,1}, {0,1},  {0,0}, {1,1}},  // Bump in middle piece.
-  {{-1,1}, {0,1},  {1,1}, {1,0}},  // L piece.
-  {{-1,0}, {0,0},  {0,1}, {1,1}},  // Z piece.
-  {{-1,0}, {-1,1}, {0,0}, {0,1}},  // Square piece.
-};
+// Prints the time each step of startup took, when enabled.
+class StartupTimer {
+ public:
+  explicit StartupTimer(const bool enabled)
+   : enabled_(enabled),
+     start_(SDL_GetPerformanceCounter()),
+     last_(start_) {
+  }
 
-void SetCoords(int** board, const CoordsPtr coords, const int piece) {
-  for (int i = 0; i < 4; ++i) {
-    board[coords[i][1]][coords[i][0]] = piece;
+  void Mark(const char* const step) {
+    const Uint64 now = SDL_GetPerformanceCounter();
+    if (enabled_) {
+      const double ms_per_count = 1000.0 / SDL_GetPerformanceFrequency();
+      printf("  %-24s %8.2f ms %8.2f ms total\n", step, (now - last_)*ms_per_count, (now - start_)*ms_per_count);
+    }
+    last_ = now;
   }
-}
 
-// Array of rotations for each tetromino to move from orientation x -> (x + 1) % 4.
-// Each rotation is an array of 4 rotations -- one for each orientation of a tetromino.
-// For each rotation, there is an array of 4 (int x, int y) coordinate diffs for each block of the tetromino.
-// The coordinate diffs map each block to its new location.
-// Thus: [block][orientation][component][x|y] to map the 4 components of each block in each orientation.
-const int rotations[NUM_TETROMINOS][4][4][2] = {
-  // Leftward L piece.
-  {{{0,2},  {1,1},   {0,0}, {-1,-1}},
-   {{2,0},  {1,-1},  {0,0}, {-1,1}},
-   {{0,-2}, {-1,-1}, {0,0}, {1,1}},
-   {{-2,0}, {-1,1},  {0,0}, {1,-1}}},
-  // Rightward Z piece. Orientation symmetry: 0==2 and 1==3.
-  {{{1,0},  {0,1},  {-1,0}, {-2,1}},
-   {{-1,0}, {0,-1}, {1,0},  {2,-1}},
-   {{1,0},  {0,1},  {-1,0}, {-2,1}},
-   {{-1,0}, {0,-1}, {1,0},  {2,-1}}},
-  // Long straight piece. Orientation symmetry: 0==2 and 1==3.
-  {{{2,-2}, {1,-1}, {0,0}, {-1,1}},
-   {{-2,2}, {-1,1}, {0,0}, {1,-1}},
-   {{2,-2}, {1,-1}, {0,0}, {-1,1}},
-   {{-2,2}, {-1,1}, {0,0}, {1,-1}}},
-  // Bump in middle piece.
-  {{{1,1},   {0,0}, {-1,1},  {-1,-1}},
-   {{1,-1},  {0,0}, {1,1},   {-1,1}},
-   {{-1,-1}, {0,0}, {1,-1},  {1,1}},
-   {{-1,1},  {0,0}, {-1,-1}, {1,-1}}},
-  // L Piece.
-  {{{1,1},   {0,0}, {-1,-1}, {-2,0}},
-   {{1,-1},  {0,0}, {-1,1},  {0,2}},
-   {{-1,-1}, {0,0}, {1,1},   {2,0}},
-   {{-1,1},  {0,0}, {1,-1},  {0,-2}}},
-  // Z piece. Orientation symmetry: 0==2 and 1==3.
-  {{{1,0},  {0,1},  {-1,0}, {-2,1}},
-   {{-1,0}, {0,-1}, {1,0},  {2,-1}},
-   {{1,0},  {0,1},  {-1,0}, {-2,1}},
-   {{-1,0}, {0,-1}, {1,0},  {2,-1}}},
-  // Square piece. Orientation symmetry: 0==1==2==3.
-  {{{0,0}, {0,0}, {0,0}, {0,0}},
-   {{0,0}, {0,0}, {0,0}, {0,0}},
-   {{0,0}, {0,0}, {0,0}, {0,0}},
-   {{0,0}, {0,0}, {0,0}, {0,0}}}
+ private:
+  const bool enabled_;
+  const Uint64 start_;
+  Uint64 last_;
 };
 
+// What the screen shows at one moment, published by the logic thread for the render thread.
+struct Snapshot {
+  // Or'd with the color of the falling piece in cells where a hard drop would land it.
+  static const uint8_t GHOST = Game::GHOST;
+
+  struct Player {
+    // The color of every cell shown, row by row, with the falling piece and its ghost drawn over the board: columns
+    // by rows cells from (left,top) of the board, each drawn cell_size pixels square.
+    std::vector<uint8_t> cells;
+    int left;
+    int top;
+    int columns;
+    int rows;
+    int cell_size;
+    int lines;
+    int level;
+    int next_piece;
+  };
+
+  // The local player's game, then in a versus match the other player's.
+  std::vector<Player> players;
+  // Whether the game or match is over, and the message shown over the screen when it is.
+  bool game_over;
+  const char* message;
+  // The sequence number of the last input the game has taken, so that the inputs this snapshot shows are known.
+  uint64_t inputs_applied;
+};
+
+// The SDL front end: owns the window, renderer, graphics, music and font, and draws snapshots of a game, or of the
+// games of each player side by side. Each board is drawn in an area of width by height blocks. A board larger than
+// that is scrolled through, and zoomed out to show more of it in smaller cells, by telling the logic thread which
+// part of it to publish.
 class GameContext {
  public:
-  GameContext(const int level=0, const int width=10, const int height=20, const int block_size=96, const int framerate=60)
-   : width_(width),
+  // Images and the first song are decoded on worker threads while the window, renderer and font are set up. The
+  // other songs are loaded when first played.
+  // Assets are read from the archive, or from files relative to the working directory if the archive is empty.
+  GameContext(StartupTimer* const startup, const AssetArchive* const assets, const int width=10, const int height=20,
+              const int block_size=96, const int players=1)
+   : assets_(assets),
+     width_(width),
      height_(height),
-     width_px_(width*block_size + 50 + 6*block_size),
+     player_px_(width*block_size + 50 + 6*block_size),
+     width_px_(players*player_px_),
      height_px_(height*block_size),
      block_size_(block_size),
-     framerate_(framerate),
-     board_(new int*[height_]()),
-     completed_lines_(std::min(45, level * 3)),
-     status_(Status::PLAY),
-     game_ticks_(0),
-     drop_ticks_(0) {
-    for (int i = 0; i < height_; ++i) {
-      board_[i] = new int[width_]();
-    }
-    current_orientation_ = 0;
-    current_piece_ = 1 + (random() % NUM_TETROMINOS);
-    next_piece_ = 1 + (random() % NUM_TETROMINOS);
-
+     players_(players),
+     counter_frequency_(SDL_GetPerformanceFrequency()),
+     cell_size_(block_size),
+     music_(),
+     static_layer_(nullptr),
+     scaled_(),
+     screen_(nullptr),
+     shown_(players),
+     shown_status_(players) {
     CHECK_SDLI(SDL_Init(SDL_INIT_AUDIO | SDL_INIT_EVENTS | SDL_INIT_TIMER | SDL_INIT_VIDEO), "SDL_Init", SDL_GetError);
+    CHECK_SDLI(Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, 4096), "Mix_OpenAudio", Mix_GetError);
+    CHECK_SDLI((IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == IMG_INIT_PNG ? 0 : -1, "IMG_Init", SDL_GetError);
+    startup->Mark("SDL, audio and image init");
+
+    // Decoding converts to the audio device's format, so it starts once audio is open.
+    std::future<Mix_Chunk*> first_song = std::async(std::launch::async, &GameContext::LoadSong, this, KOROBEINIKI);
+    const char* const sprite_files[NUM_SPRITES] = {
+      "graphics/block_black.png", "graphics/block_blue.png", "graphics/block_cyan.png", "graphics/block_green.png",
+      "graphics/block_orange.png", "graphics/block_purple.png", "graphics/block_red.png", "graphics/block_yellow.png",
+      "graphics/logo.png", "graphics/wall.png"};
+    std::future<SDL_Surface*> images[NUM_SPRITES];
+    for (int i = 0; i < NUM_SPRITES; ++i) {
+      images[i] = std::async(std::launch::async, &GameContext::DecodeImage, this, sprite_files[i]);
+    }
+
     CHECK_SDLI(SDL_CreateWindowAndRenderer(width_px_, height_px_, SDL_WINDOW_SHOWN, &window_, &renderer_), "Window", SDL_GetError);
     SDL_SetWindowTitle(window_, "TETRIS");
-
-    CHECK_SDLI((IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG) == IMG_INIT_PNG ? 0 : -1, "IMG_Init", SDL_GetError);
-    CHECK_SDLP(graphics_.block_black  = IMG_LoadTexture(renderer_, "graphics/block_black.png"),  "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_blue   = IMG_LoadTexture(renderer_, "graphics/block_blue.png"),   "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_cyan   = IMG_LoadTexture(renderer_, "graphics/block_cyan.png"),   "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_green  = IMG_LoadTexture(renderer_, "graphics/block_green.png"),  "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_orange = IMG_LoadTexture(renderer_, "graphics/block_orange.png"), "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_purple = IMG_LoadTexture(renderer_, "graphics/block_purple.png"), "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_red    = IMG_LoadTexture(renderer_, "graphics/block_red.png"),    "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.block_yellow = IMG_LoadTexture(renderer_, "graphics/block_yellow.png"), "IMG_LoadTexture", SDL_GetError);
-    graphics_.blocks[0] = graphics_.block_black;
-    graphics_.blocks[1] = graphics_.block_blue;
-    graphics_.blocks[2] = graphics_.block_cyan;
-    graphics_.blocks[3] = graphics_.block_green;
-    graphics_.blocks[4] = graphics_.block_orange;
-    graphics_.blocks[5] = graphics_.block_purple;
-    graphics_.blocks[6] = graphics_.block_red;
-    graphics_.blocks[7] = graphics_.block_yellow;
-    CHECK_SDLP(graphics_.logo         = IMG_LoadTexture(renderer_, "graphics/logo.png"),         "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLP(graphics_.wall         = IMG_LoadTexture(renderer_, "graphics/wall.png"),         "IMG_LoadTexture", SDL_GetError);
-    CHECK_SDLI(Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, 4096), "Mix_OpenAudio", Mix_GetError);
-    CHECK_SDLP(music_.song_korobeiniki  = Mix_LoadWAV("sound/korobeiniki.wav"),  "Mix_LoadWAV", Mix_GetError);
-    CHECK_SDLP(music_.song_bwv814menuet = Mix_LoadWAV("sound/bwv814menuet.wav"), "Mix_LoadWAV", Mix_GetError);
-    CHECK_SDLP(music_.song_russiansong  = Mix_LoadWAV("sound/russiansong.wav"),  "Mix_LoadWAV", Mix_GetError);
-    CHECK_SDLP(music_.gameover          = Mix_LoadWAV("sound/gameover.wav"),     "Mix_LoadWAV", Mix_GetError);
-    music_.songs[0] = music_.song_korobeiniki;
-    music_.songs[1] = music_.song_bwv814menuet;
-    music_.songs[2] = music_.song_russiansong;
-    music_.songs[3] = music_.gameover;
-    CHECK_SDLI(Mix_PlayChannel(0, music_.song_korobeiniki, -1), "Mix_PlayChannel", SDL_GetError);
+    if (SDL_RenderTargetSupported(renderer_)) {
+      CHECK_SDLP(screen_ = SDL_CreateTexture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width_px_, height_px_),
+                 "SDL_CreateTexture", SDL_GetError);
+    }
+    Invalidate();
+    startup->Mark("Window and renderer");
 
     CHECK_SDLI(TTF_Init(),"TTF_Init", TTF_GetError);
-    CHECK_SDLP(font_ = TTF_OpenFont("fonts/Montserrat-Regular.ttf", 48), "TTF_OpenFont", TTF_GetError);
+    CHECK_SDLP(font_ = TTF_OpenFontRW(OpenAsset("fonts/Montserrat-Regular.ttf"), 1, 48), "TTF_OpenFont", TTF_GetError);
+    BuildGlyphAtlas();
+    startup->Mark("Font and glyph atlas");
+
+    // Textures are created on this thread, which owns the renderer.
+    SDL_Surface* decoded[NUM_SPRITES];
+    for (int i = 0; i < NUM_SPRITES; ++i) {
+      decoded[i] = images[i].get();
+    }
+    startup->Mark("Wait for images");
+    PackSprites(decoded);
+    BuildStaticLayer();
+    ScaleSprites();
+    startup->Mark("Sprite atlas");
+
+    music_.songs[KOROBEINIKI] = first_song.get();
+    startup->Mark("Wait for the first song");
+    if (music_.songs[KOROBEINIKI]) {
+      CHECK_SDLI(Mix_PlayChannel(0, music_.songs[KOROBEINIKI], -1), "Mix_PlayChannel", SDL_GetError);
+    }
   }
 
   ~GameContext() {
+    if (screen_) {
+      SDL_DestroyTexture(screen_);
+    }
+    SDL_DestroyTexture(glyph_atlas_);
+    SDL_DestroyTexture(static_layer_);
+    SDL_DestroyTexture(scaled_.texture);
+    SDL_FreeSurface(graphics_.atlas);
     SDL_DestroyRenderer(renderer_);
     SDL_DestroyWindow(window_);
     SDL_Quit();
   }
 
-  bool ExecuteBoardPiece(void (GameContext::*execute)(int, int, int)) {
-    const int center = width_ / 2;
-    for (int i = 0; i < 4; ++i) {
-      const int x = center + starting_positions[current_piece_-1][i][0];
-      const int y = starting_positions[current_piece_-1][i][1];
-      if (board_[y][x]) {
-        return true;
-      }
-      std::invoke(execute, this, i, x, y);
+  enum Songs {KOROBEINIKI, BWV814MENUET, RUSSIANSONG, GAMEOVERSONG};
+
+  void PlayMusic(int choice, bool loop) {
+    choice = std::max(std::min(choice, 3), 0);
+    if (!music_.songs[choice]) {
+      music_.songs[choice] = LoadSong(choice);
+    }
+    if (music_.songs[choice]) {
+      Mix_PlayChannel(0, music_.songs[choice], loop);
+    } else {
+      // Whatever was playing stops, as it would for the song.
+      Mix_HaltChannel(0);
     }
-    return false;
   }
 
-  void NullPlacement(int i, int x, int y) { }
-
-  void ActivePlacement(const int i, const int x, const int y) {
-    board_[y][x] = current_piece_;
-    current_coords_[i][0] = x;
-    current_coords_[i][1] = y;
+  // Makes the next DrawScreen() redraw everything, as when the renderer loses the contents of the screen texture.
+  void Invalidate() {
+    for (ShownBoard& shown : shown_) {
+      shown.cell_size = 0;
+    }
+    std::fill(shown_status_.begin(), shown_status_.end(), std::array<int, 3>{-1, -1, -1});
   }
 
-  // Sets the game over condition if adding a new piece collides. Checks game-over before adding piece to the board
-  // so the final piece is not written to the screen with a collision.
-  void AddBoardPiece() {
-    current_orientation_ = 0;
-    current_piece_ = next_piece_;
-    next_piece_ = 1 + (random() % NUM_TETROMINOS);
-    if (ExecuteBoardPiece(&GameContext::NullPlacement)) {
-      status_ = Status::GAMEOVER;
-    } else {
-      ExecuteBoardPiece(&GameContext::ActivePlacement);
+  // Halves the cell size for each step out, down to MIN_CELL_SIZE, or doubles it for each step in, up to the block
+  // size, and scales the block sprites to it. Returns whether it changed.
+  bool Zoom(const int steps) {
+    int cell_size = cell_size_;
+    for (int i = 0; i < std::abs(steps); ++i) {
+      cell_size = steps < 0 ? std::max(cell_size / 2, MIN_CELL_SIZE) : std::min(cell_size * 2, block_size_);
     }
+    if (cell_size == cell_size_) {
+      return false;
+    }
+    cell_size_ = cell_size;
+    ScaleSprites();
+    return true;
   }
 
-  void TimeKeep(Uint64 now_ms, Uint64* last_frame_ms) {
-    Uint64 ms_per_frame = 1000 / framerate_;
-    if ((now_ms - *last_frame_ms) >= ms_per_frame) {
-      ++game_ticks_;
-      *last_frame_ms = now_ms;
+  // The size of the cells of the board area at the present zoom, and how many of them fit in it.
+  int cell_size() const { return cell_size_; }
+  int view_columns() const { return width_*block_size_ / cell_size_; }
+  int view_rows() const { return height_*block_size_ / cell_size_; }
+
+  // Draws what changed in the snapshot since the last call into the screen texture, then presents the texture.
+  void DrawScreen(const Snapshot& snapshot) {
+    PROFILE_SCOPE("DrawScreen");
+    if (screen_) {
+      CHECK_SDLI(SDL_SetRenderTarget(renderer_, screen_), "SDL_SetRenderTarget", SDL_GetError);
+    } else {
+      Invalidate();
+    }
+    for (int player = 0; player < players_; ++player) {
+      DrawBoard(snapshot.players[player], player);
+      DrawStatus(snapshot.players[player], player);
+    }
+    DrawSprites();
+    if (screen_) {
+      CHECK_SDLI(SDL_SetRenderTarget(renderer_, nullptr), "SDL_SetRenderTarget", SDL_GetError);
+      SDL_RenderCopy(renderer_, screen_, nullptr, nullptr);
+    }
+    // The message is drawn over the presented frame, not into the screen texture, so the board under it is intact.
+    if (snapshot.game_over) {
+      // Clear a rectangle for the game-over message and write the message.
+      SDL_Rect msgbox = {.x=0, .y=static_cast<int>(height_px_*0.4375), .w=width_px_, .h=static_cast<int>(height_px_*0.125)};
+      SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
+      SDL_RenderFillRect(renderer_, &msgbox);
+      DrawText(snapshot.message, width_px_*0.05, height_px_*0.4375, width_px_*0.9, height_px_*0.125);
+    }
+    {
+      PROFILE_SCOPE("SDL_RenderPresent");
+      SDL_RenderPresent(renderer_);
+    }
+    if (!unpresented_inputs_.empty()) {
+      const Uint64 presented = SDL_GetPerformanceCounter();
+      for (const Uint64 dequeued : unpresented_inputs_) {
+        latency_.Record((presented - dequeued)*1000000000.0/counter_frequency_);
+      }
+      unpresented_inputs_.clear();
     }
   }
 
-  bool IsGameOver() const { return status_ == Status::GAMEOVER; }
+  // Notes that an input dequeued at a performance counter time changed the game. Its latency is measured when the
+  // next DrawScreen() presents the change.
+  void InputChanged(const Uint64 dequeued) {
+    unpresented_inputs_.push_back(dequeued);
+  }
 
-  bool IsInPlay() const { return status_ == Status::PLAY; }
+  void PrintLatency() const {
+    printf("Input to present latency over %lu inputs: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           latency_.count(), latency_.Percentile(0.50)/1e6, latency_.Percentile(0.95)/1e6,
+           latency_.Percentile(0.99)/1e6, latency_.max()/1e6);
+  }
 
-  void PlayMusic(int choice, bool loop) const {
-    choice = std::max(std::min(choice, 3), 0);
-    Mix_PlayChannel(0, music_.songs[choice], loop);
+ private:
+  // Draws the cells of a player's board whose color differs from what the screen shows. A move redraws the 8 or fewer
+  // cells the falling piece left and entered, and locking a piece redraws only the rows that changed. Scrolling or
+  // zooming redraws every cell shown, and only those, however large the board is.
+  void DrawBoard(const Snapshot::Player& snapshot, const int player) {
+    PROFILE_SCOPE("DrawBoard");
+    const int left = player*player_px_;
+    ShownBoard& shown = shown_[player];
+    if (shown.left != snapshot.left || shown.top != snapshot.top || shown.columns != snapshot.columns ||
+        shown.rows != snapshot.rows || shown.cell_size != snapshot.cell_size) {
+      shown.left = snapshot.left;
+      shown.top = snapshot.top;
+      shown.columns = snapshot.columns;
+      shown.rows = snapshot.rows;
+      shown.cell_size = snapshot.cell_size;
+      shown.cells.assign(snapshot.columns*snapshot.rows, -1);
+      // Zoomed out, a board can be smaller than its area, which is black around it.
+      const SDL_Rect area = {.x=left, .y=0, .w=width_*block_size_, .h=height_*block_size_};
+      SDL_SetRenderDrawColor(renderer_, 0, 0, 0, 255);
+      SDL_RenderFillRect(renderer_, &area);
+    }
+    const int size = snapshot.cell_size;
+    for (int y = 0; y < snapshot.rows; ++y) {
+      for (int x = 0; x < snapshot.columns; ++x) {
+        const int color = snapshot.cells[y*snapshot.columns + x];
+        int& shown_color = shown.cells[y*snapshot.columns + x];
+        if (shown_color != color) {
+          shown_color = color;
+          const SDL_Rect cell = {.x=left + x*size, .y=y*size, .w=size, .h=size};
+          QueueSprite(color & Snapshot::GHOST ? scaled_.ghosts[color & ~Snapshot::GHOST] : scaled_.cells[color], cell);
+        }
+      }
+    }
   }
 
-  enum Songs {KOROBEINIKI, BWV814MENUET, RUSSIANSONG, GAMEOVERSONG};
+  // The blocks in color order, then the logo and the wall.
+  static const int NUM_SPRITES = 10;
+  // The smallest cells a board is zoomed out to, in pixels.
+  static const int MIN_CELL_SIZE = 3;
+  static const Uint8 GHOST_ALPHA = 64;
 
-  void DrawScreen() {
-    DrawBoard();
-    DrawStatus();
-    if (status_ == Status::GAMEOVER) {
-      // Clear a rectangle for the game-over message and write the message.
-      SDL_Rect msgbox = {.x=0, .y=static_cast<int>(height_px_*0.4375), .w=width_px_, .h=static_cast<int>(height_px_*0.125)};
-      SDL_RenderCopy(renderer_, graphics_.block_black, nullptr, &msgbox);
-      const char msg[37] = "The only winning move is not to play";
-      DrawText(msg, width_px_*0.05, height_px_*0.4375, width_px_*0.9, height_px_*0.125);
+  // Returns a stream over an asset, which is a view of the mapped archive when there is one. Exits if there is no
+  // such asset, unless it is optional, when it returns null. Safe to call from any thread, as are DecodeImage() and
+  // LoadSong(), which use no renderer.
+  SDL_RWops* OpenAsset(const char* const name, const bool optional=false) const {
+    SDL_RWops* stream;
+    if (assets_->empty()) {
+      stream = SDL_RWFromFile(name, "rb");
+      if (!optional) {
+        CHECK_SDLP(stream, "SDL_RWFromFile", SDL_GetError);
+      }
+      return stream;
     }
-    SDL_RenderPresent(renderer_);
-    CHECK_SDLI(SDL_RenderClear(renderer_), "SDL_Render_Clear", SDL_GetError);
+    size_t size;
+    const uint8_t* const data = assets_->Find(name, &size);
+    if (!data) {
+      if (optional) {
+        return nullptr;
+      }
+      std::cerr << "Asset archive has no " << name << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    CHECK_SDLP(stream = SDL_RWFromConstMem(data, size), "SDL_RWFromConstMem", SDL_GetError);
+    return stream;
   }
 
-  void Pause() {
-    switch (status_) {
-      case PLAY:
-        status_ = PAUSE;
-        break;
-      case PAUSE:
-        status_ = PLAY;
-        break;
-      default:
-        break;
+  SDL_Surface* DecodeImage(const char* const file) const {
+    SDL_Surface* image;
+    SDL_Surface* converted;
+    CHECK_SDLP(image = IMG_Load_RW(OpenAsset(file), 1), "IMG_Load", SDL_GetError);
+    CHECK_SDLP(converted = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_RGBA32, 0), "SDL_ConvertSurfaceFormat", SDL_GetError);
+    SDL_FreeSurface(image);
+    return converted;
+  }
+
+  // Returns null for a song that is not among the assets, which is then not played.
+  Mix_Chunk* LoadSong(const int song) const {
+    const char* const files[4] = {"sound/korobeiniki.wav", "sound/bwv814menuet.wav", "sound/russiansong.wav",
+                                  "sound/gameover.wav"};
+    SDL_RWops* const stream = OpenAsset(files[song], true);
+    if (!stream) {
+      return nullptr;
     }
+    Mix_Chunk* chunk;
+    CHECK_SDLP(chunk = Mix_LoadWAV_RW(stream, 1), "Mix_LoadWAV", Mix_GetError);
+    return chunk;
   }
 
-  bool DropCheck() {
-    if (game_ticks_ >= drop_ticks_ + std::max(15 - completed_lines_ / 3, 1)) {
-      drop_ticks_ = game_ticks_;
-      return true;
+  // Packs the decoded sprite images side by side into graphics_.atlas, and frees them. The atlas is kept to scale
+  // sprites from.
+  void PackSprites(SDL_Surface* const (&images)[NUM_SPRITES]) {
+    SDL_Rect* const rects[NUM_SPRITES] = {
+      &graphics_.blocks[0], &graphics_.blocks[1], &graphics_.blocks[2], &graphics_.blocks[3], &graphics_.blocks[4],
+      &graphics_.blocks[5], &graphics_.blocks[6], &graphics_.blocks[7], &graphics_.logo, &graphics_.wall};
+    int width = 0;
+    int height = 0;
+    for (int i = 0; i < NUM_SPRITES; ++i) {
+      *rects[i] = {.x=width, .y=0, .w=images[i]->w, .h=images[i]->h};
+      width += images[i]->w;
+      height = std::max(height, images[i]->h);
+    }
+    CHECK_SDLP(graphics_.atlas = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32),
+               "SDL_CreateRGBSurfaceWithFormat", SDL_GetError);
+    for (int i = 0; i < NUM_SPRITES; ++i) {
+      // Copy the pixels, alpha included, rather than blending them onto the empty atlas.
+      SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE);
+      CHECK_SDLI(SDL_BlitSurface(images[i], nullptr, graphics_.atlas, rects[i]), "SDL_BlitSurface", SDL_GetError);
+      SDL_FreeSurface(images[i]);
     }
-    return false;
   }
 
-  bool CollisionDetected(const int dx, const int dy) {
-    bool collision = false;
-    // Clear the board where the piece currently is to not detect self collision.
-    SetCoords(board_, current_coords_, 0);
-    for (int i = 0; i < 4; ++i) {
-      const int x = current_coords_[i][0];
-      const int y = current_coords_[i][1];
-      // Collision is hitting the left wall, right wall, bottom, or a non-black block.
-      // Since this collision detection is only for movement, check the top (y < 0) is not needed.
-      if ((x + dx) < 0 || (x + dx) >= width_ || (y + dy) >= height_ || board_[y+dy][x+dx]) {
-        collision = true;
-        break;
-      }
+  // Scales a sprite of the atlas into a rectangle of a surface, blended with the given opacity, or copied with its
+  // alpha when opaque.
+  void BlitSprite(const SDL_Rect& src, SDL_Surface* const surface, SDL_Rect dst, const Uint8 alpha=255) {
+    SDL_SetSurfaceBlendMode(graphics_.atlas, alpha == 255 ? SDL_BLENDMODE_NONE : SDL_BLENDMODE_BLEND);
+    SDL_SetSurfaceAlphaMod(graphics_.atlas, alpha);
+    CHECK_SDLI(SDL_BlitScaled(graphics_.atlas, &src, surface, &dst), "SDL_BlitScaled", SDL_GetError);
+  }
+
+  // Draws what never changes once into static_layer_: the black background of each board and status panel, the
+  // wall between them and the logo. A status panel is then one copy of the layer without scaling.
+  void BuildStaticLayer() {
+    SDL_Surface* layer;
+    CHECK_SDLP(layer = SDL_CreateRGBSurfaceWithFormat(0, width_px_, height_px_, 32, SDL_PIXELFORMAT_RGBA32),
+               "SDL_CreateRGBSurfaceWithFormat", SDL_GetError);
+    SDL_FillRect(layer, nullptr, SDL_MapRGBA(layer->format, 0, 0, 0, 255));
+    for (int player = 0; player < players_; ++player) {
+      const int left = player*player_px_;
+      // Wall extends from top to bottom, separating the board from the status area.
+      SDL_SetSurfaceBlendMode(graphics_.atlas, SDL_BLENDMODE_BLEND);
+      SDL_SetSurfaceAlphaMod(graphics_.atlas, 255);
+      SDL_Rect wall = {.x=left + width_*block_size_, .y=0, .w=50, .h=height_*block_size_};
+      CHECK_SDLI(SDL_BlitScaled(graphics_.atlas, &graphics_.wall, layer, &wall), "SDL_BlitScaled", SDL_GetError);
+      // The logo sits at the top right of the panel right of the wall.
+      SDL_Rect logo = {.x=PanelLeft(player), .y=0, .w=PanelWidth(), .h=static_cast<int>(height_px_*0.20)};
+      CHECK_SDLI(SDL_BlitScaled(graphics_.atlas, &graphics_.logo, layer, &logo), "SDL_BlitScaled", SDL_GetError);
     }
-    // Restore the current piece.
-    SetCoords(board_, current_coords_, current_piece_);
-    return collision;
+    CHECK_SDLP(static_layer_ = SDL_CreateTextureFromSurface(renderer_, layer), "Static layer", SDL_GetError);
+    SDL_FreeSurface(layer);
   }
 
-  void MoveTetromino(const int dx, const int dy) {
-    // Clear the board where the piece currently is.
-    for (int i = 0; i < 4; ++i) {
-      const int x = current_coords_[i][0];
-      const int y = current_coords_[i][1];
-      board_[y][x] = 0;
+  // Scales the blocks once to the sizes they are drawn at, so that drawing a cell copies pixels without scaling:
+  // each color at the board's cell size, the ghost of each, a faint block of its color over an empty cell, and each
+  // color at the block size for the next piece. Called again when the cell size changes.
+  void ScaleSprites() {
+    PROFILE_SCOPE("ScaleSprites");
+    const int cell = cell_size_;
+    const int block = block_size_;
+    SDL_Surface* sprites;
+    CHECK_SDLP(sprites = SDL_CreateRGBSurfaceWithFormat(0, 16*cell + 8*block, std::max(cell, block), 32,
+                                                        SDL_PIXELFORMAT_RGBA32),
+               "SDL_CreateRGBSurfaceWithFormat", SDL_GetError);
+    for (int color = 0; color < 8; ++color) {
+      scaled_.cells[color] = {.x=color*cell, .y=0, .w=cell, .h=cell};
+      scaled_.ghosts[color] = {.x=(8 + color)*cell, .y=0, .w=cell, .h=cell};
+      scaled_.blocks[color] = {.x=16*cell + color*block, .y=0, .w=block, .h=block};
+      BlitSprite(graphics_.blocks[color], sprites, scaled_.cells[color]);
+      BlitSprite(graphics_.blocks[0], sprites, scaled_.ghosts[color]);
+      BlitSprite(graphics_.blocks[color], sprites, scaled_.ghosts[color], GHOST_ALPHA);
+      BlitSprite(graphics_.blocks[color], sprites, scaled_.blocks[color]);
     }
-    // Update the current piece's coordinates and fill the board in the new coordinates.
-    for (int i = 0; i < 4; ++i) {
-      current_coords_[i][0] += dx;
-      current_coords_[i][1] += dy;
-      board_[current_coords_[i][1]][current_coords_[i][0]] = current_piece_;
+    if (scaled_.texture) {
+      SDL_DestroyTexture(scaled_.texture);
     }
+    CHECK_SDLP(scaled_.texture = SDL_CreateTextureFromSurface(renderer_, sprites), "Scaled sprites", SDL_GetError);
+    scaled_.width = sprites->w;
+    scaled_.height = sprites->h;
+    SDL_FreeSurface(sprites);
+  }
+
+  // The left edge and width of a player's status panel right of the wall, where the logo, text and next piece go.
+  int PanelLeft(const int player) const { return player*player_px_ + width_*block_size_ + 50 + 6*block_size_*0.05; }
+  int PanelWidth() const { return 6*block_size_*0.90; }
+
+  // Queues a copy of a scaled sprite to the current render target.
+  void QueueSprite(const SDL_Rect& src, const SDL_Rect& dst) {
+    sprites_.push_back(SpriteCopy{.src=src, .dst=dst});
   }
 
-  // Clear completed (filled) rows.
-  // Start from the bottom of the board, moving all rows down to fill in a completed row, with
-  // the completed row cleared and placed at the top.
-  void ClearBoard() {
-    int rows_deleted = 0;
-    for (int row = height_ - 1; row >= rows_deleted;) {
-      bool has_hole = false;
-      for (int x = 0; x < width_ && !has_hole; ++x) {
-        has_hole = !board_[row][x];
+  // Draws the queued sprites with one call, as two triangles each, or with a copy each before SDL 2.0.18.
+  void DrawSprites() {
+    PROFILE_SCOPE("DrawSprites");
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    vertices_.clear();
+    indices_.clear();
+    const SDL_Color color = {.r=255, .g=255, .b=255, .a=255};
+    for (const SpriteCopy& sprite : sprites_) {
+      const int first = vertices_.size();
+      for (int corner = 0; corner < 4; ++corner) {
+        const int right = corner & 1;
+        const int bottom = corner >> 1;
+        const SDL_FPoint position = {.x=static_cast<float>(sprite.dst.x + right*sprite.dst.w),
+                                     .y=static_cast<float>(sprite.dst.y + bottom*sprite.dst.h)};
+        const SDL_FPoint tex_coord = {.x=static_cast<float>(sprite.src.x + right*sprite.src.w) / scaled_.width,
+                                      .y=static_cast<float>(sprite.src.y + bottom*sprite.src.h) / scaled_.height};
+        vertices_.push_back(SDL_Vertex{.position=position, .color=color, .tex_coord=tex_coord});
       }
-      if (!has_hole) {
-        int* deleted_row = board_[row];
-        for (int y = row; y > rows_deleted; --y) {
-          board_[y] = board_[y-1];
-        }
-        board_[rows_deleted] = deleted_row;
-        memset(board_[rows_deleted], 0, width_ * sizeof(int));
-        ++rows_deleted;
-      } else {
-        --row;
+      for (const int corner : {0, 1, 2, 2, 1, 3}) {
+        indices_.push_back(first + corner);
       }
     }
-    completed_lines_ += rows_deleted;
+    if (!vertices_.empty()) {
+      SDL_RenderGeometry(renderer_, scaled_.texture, vertices_.data(), vertices_.size(), indices_.data(), indices_.size());
+    }
+#else
+    for (const SpriteCopy& sprite : sprites_) {
+      SDL_RenderCopy(renderer_, scaled_.texture, &sprite.src, &sprite.dst);
+    }
+#endif
+    sprites_.clear();
   }
 
-  bool Rotate() {
-    Coords new_coords;
-    const int (* const rotation)[2] = rotations[current_piece_-1][current_orientation_];
-    for (int i = 0; i < 4; ++i) {
-      new_coords[i][0] = current_coords_[i][0] + rotation[i][0];
-      new_coords[i][1] = current_coords_[i][1] + rotation[i][1];
+  // Rasterizes the printable ASCII characters of the font once, side by side, into one texture, so that drawing text
+  // creates no surfaces or textures. Glyphs are white and tinted red when copied.
+  void BuildGlyphAtlas() {
+    const SDL_Color white = {.r=255, .g=255, .b=255, .a=255};
+    SDL_Surface* glyphs[NUM_GLYPHS];
+    int atlas_width = 0;
+    for (int i = 0; i < NUM_GLYPHS; ++i) {
+      CHECK_SDLP(glyphs[i] = TTF_RenderGlyph_Solid(font_, FIRST_GLYPH + i, white), "TTF_RenderGlyph_Solid", TTF_GetError);
+      atlas_width += glyphs[i]->w;
     }
-
-    // Clear the board where the piece currently is to not detect self collision.
-    SetCoords(board_, current_coords_, 0);
-    for (int i = 0; i < 4; ++i) {
-      const int x = new_coords[i][0];
-      const int y = new_coords[i][1];
-      // Collision is hitting the left wall, right wall, top, bottom, or a non-black block.
-      if (x < 0 || x >= width_ || y < 0 || y >= height_ || board_[y][x]) {
-        // Restore the current piece.
-        SetCoords(board_, current_coords_, current_piece_);
-        return false;
-      }
+    const int height = TTF_FontHeight(font_);
+    SDL_Surface* atlas;
+    CHECK_SDLP(atlas = SDL_CreateRGBSurfaceWithFormat(0, atlas_width, height, 32, SDL_PIXELFORMAT_RGBA32),
+               "SDL_CreateRGBSurfaceWithFormat", SDL_GetError);
+    for (int i = 0, x = 0; i < NUM_GLYPHS; x += glyphs[i]->w, ++i) {
+      // The atlas starts transparent, and the glyph's background is its color key, so only the glyph is copied.
+      SDL_Rect dst = {.x=x, .y=0, .w=glyphs[i]->w, .h=glyphs[i]->h};
+      CHECK_SDLI(SDL_BlitSurface(glyphs[i], nullptr, atlas, &dst), "SDL_BlitSurface", SDL_GetError);
+      glyph_rects_[i] = {.x=x, .y=0, .w=glyphs[i]->w, .h=height};
+      SDL_FreeSurface(glyphs[i]);
     }
+    CHECK_SDLP(glyph_atlas_ = SDL_CreateTextureFromSurface(renderer_, atlas), "Glyph atlas", SDL_GetError);
+    SDL_FreeSurface(atlas);
+    SDL_SetTextureBlendMode(glyph_atlas_, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureColorMod(glyph_atlas_, 255, 0, 0);
+  }
 
-    for (int i = 0; i < 4; ++i) {
-      current_coords_[i][0] = new_coords[i][0];
-      current_coords_[i][1] = new_coords[i][1];
-      board_[new_coords[i][1]][new_coords[i][0]] = current_piece_;
-    }
-    current_orientation_ = (current_orientation_ + 1) % 4;
-    return true;
+  // Characters outside the atlas are drawn as spaces.
+  const SDL_Rect& Glyph(const char c) const {
+    const int i = c - FIRST_GLYPH;
+    return glyph_rects_[i >= 0 && i < NUM_GLYPHS ? i : 0];
   }
 
- private:
-  void DrawBoard() {
-    for (int y = 0; y < height_; ++y) {
-      for (int x = 0; x < width_; ++x) {
-        SDL_Rect dst = {.x=x*block_size_, .y=y*block_size_, .w=block_size_, .h=block_size_};
-        SDL_RenderCopy(renderer_, graphics_.blocks[board_[y][x]], nullptr, &dst);
-      }
+  // Draws the text stretched to fill the rectangle, one atlas copy per character.
+  void DrawText(const char* const s, const int x, const int y, const int w, const int h) {
+    PROFILE_SCOPE("DrawText");
+    int text_width = 0;
+    for (const char* c = s; *c; ++c) {
+      text_width += Glyph(*c).w;
+    }
+    int left = 0;
+    for (const char* c = s; *c; ++c) {
+      const SDL_Rect& src = Glyph(*c);
+      const int dst_left = x + left*w/text_width;
+      left += src.w;
+      SDL_Rect dst = {.x=dst_left, .y=y, .w=x + left*w/text_width - dst_left, .h=h};
+      SDL_RenderCopy(renderer_, glyph_atlas_, &src, &dst);
     }
   }
 
-  void DrawText(const char* const s, const int x, const int y, const int w, const int h) {
-    SDL_Color red = {.r=255, .g=0, .b=0, .a=255};
-    SDL_Surface* stext = TTF_RenderText_Solid(font_, s, red);
-    SDL_Texture* text;
-    CHECK_SDLP(text = SDL_CreateTextureFromSurface(renderer_, stext), "Render text", SDL_GetError);
-    SDL_Rect dsttext = {.x=x, .y=y, .w=w, .h=h};
-    SDL_RenderCopy(renderer_, text, nullptr, &dsttext);
-    SDL_FreeSurface(stext);
-    SDL_DestroyTexture(text);
-  }
-
-  void DrawStatus() {
-    // Wall extends from top to bottom, separating the board from the status area.
-    SDL_Rect dstwall = {.x=width_*block_size_, .y=0, .w=50, .h=height_*block_size_};
-    SDL_RenderCopy(renderer_, graphics_.wall, NULL, &dstwall);
-
-    // The logo sits at the top right of the screen right of the wall.
-    const int left_border = width_*block_size_ + 50 + 6*block_size_*0.05;
-    const int width = 6*block_size_*0.90;
-    SDL_Rect dstlogo = {.x=left_border, .y=0, .w=width, .h=static_cast<int>(height_px_*0.20)};
-    SDL_RenderCopy(renderer_, graphics_.logo, NULL, &dstlogo);
+  // Redraws a player's status panel, right of their board, when the lines, level or next piece changed: the wall,
+  // logo and background as one copy of the static layer, then the text and the next piece.
+  void DrawStatus(const Snapshot::Player& snapshot, const int player) {
+    PROFILE_SCOPE("DrawStatus");
+    const std::array<int, 3> status = {snapshot.lines, snapshot.level, snapshot.next_piece};
+    if (status == shown_status_[player]) {
+      return;
+    }
+    shown_status_[player] = status;
+    const int left = player*player_px_;
+    const SDL_Rect panel = {.x=left + width_*block_size_, .y=0, .w=player_px_ - width_*block_size_, .h=height_px_};
+    SDL_RenderCopy(renderer_, static_layer_, &panel, &panel);
+    const int left_border = PanelLeft(player);
+    const int width = PanelWidth();
 
     // Write the number of completed lines.
     char text_lines[12];
-    snprintf(text_lines, sizeof(text_lines), "Lines: %d", completed_lines_);
+    snprintf(text_lines, sizeof(text_lines), "Lines: %d", snapshot.lines);
     DrawText(text_lines, left_border, height_px_*0.25, width, height_px_*0.05);
 
     // Write the current game level.
-    snprintf(text_lines, sizeof(text_lines), "Level: %d", completed_lines_ / 3);
+    snprintf(text_lines, sizeof(text_lines), "Level: %d", snapshot.level);
     DrawText(text_lines, left_border, height_px_*0.35, width, height_px_*0.05);
 
     // Draw the next tetromino piece.
+    const int next_piece = snapshot.next_piece;
     for (int i = 0; i < 4; ++i) {
       const int top_border = height_px_ * 0.45;
-      const int left_border = (width_ + 2)*block_size_ + 50 + 6*block_size_*0.05;
-      const int x = left_border + starting_positions[next_piece_-1][i][0]*block_size_;
-      const int y = top_border + starting_positions[next_piece_-1][i][1]*block_size_;
-      SDL_Rect dst = {.x=x, .y=y, .w=block_size_, .h=block_size_};
-      SDL_RenderCopy(renderer_, graphics_.blocks[next_piece_], NULL, &dst);
+      const int x = left_border + (2 + starting_positions[next_piece-1][i][0])*block_size_;
+      const int y = top_border + starting_positions[next_piece-1][i][1]*block_size_;
+      QueueSprite(scaled_.blocks[next_piece], {.x=x, .y=y, .w=block_size_, .h=block_size_});
     }
   }
 
-  // Width and height are of the playing board, whereas width_px and height_px are for the whole screen, which includes status.
+  const AssetArchive* const assets_;
+  // Width and height are of the board area in blocks, whereas width_px and height_px are for the whole screen, which includes status.
+  // player_px is the width of one player's board and status panel.
   const int width_;
   const int height_;
+  const int player_px_;
   const int width_px_;
   const int height_px_;
   const int block_size_;
-  const int framerate_;
-  int **board_;
-  int current_piece_;
-  int current_orientation_;
-  Coords current_coords_;
-  int next_piece_;
-  int completed_lines_;
-  enum Status {PLAY, PAUSE, GAMEOVER} status_;
-  Uint64 game_ticks_;
-  Uint64 drop_ticks_;
+  const int players_;
+  const Uint64 counter_frequency_;
+  // The size of board cells at the present zoom.
+  int cell_size_;
+  LatencyHistogram latency_;
+  // When each input that changed the game since the last present was dequeued.
+  std::vector<Uint64> unpresented_inputs_;
   struct {
-    Mix_Chunk* song_korobeiniki;
-    Mix_Chunk* song_bwv814menuet;
-    Mix_Chunk* song_russiansong;
-    Mix_Chunk* gameover;
+    // Indexed by Songs, and null until first played.
     Mix_Chunk* songs[4];
   } music_;
+  // Every sprite as decoded, packed side by side into one surface that the textures below are made from.
   struct {
-    SDL_Texture* block_black;
-    SDL_Texture* block_blue;
-    SDL_Texture* block_cyan;
-    SDL_Texture* block_green;
-    SDL_Texture* block_orange;
-    SDL_Texture* block_purple;
-    SDL_Texture* block_red;
-    SDL_Texture* block_yellow;
-    SDL_Texture* blocks[8];
-    SDL_Texture* gameover;
-    SDL_Texture* logo;
-    SDL_Texture* wall;
+    SDL_Surface* atlas;
+    SDL_Rect blocks[8];
+    SDL_Rect logo;
+    SDL_Rect wall;
   } graphics_;
+  // The background, wall and logo of the whole screen, as BuildStaticLayer() draws them.
+  SDL_Texture* static_layer_;
+  // The blocks as ScaleSprites() scales them, in one texture of width by height pixels.
+  struct {
+    SDL_Texture* texture;
+    int width;
+    int height;
+    SDL_Rect cells[8];
+    SDL_Rect ghosts[8];
+    SDL_Rect blocks[8];
+  } scaled_;
+  // Sprites queued for the next DrawSprites().
+  struct SpriteCopy {
+    SDL_Rect src;
+    SDL_Rect dst;
+  };
+  std::vector<SpriteCopy> sprites_;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+  std::vector<SDL_Vertex> vertices_;
+  std::vector<int> indices_;
+#endif
   SDL_Window* window_;
   SDL_Renderer* renderer_;
   TTF_Font* font_;
+  static const int FIRST_GLYPH = ' ';
+  static const int NUM_GLYPHS = '~' - ' ' + 1;
+  SDL_Texture* glyph_atlas_;
+  SDL_Rect glyph_rects_[NUM_GLYPHS];
+  // The whole screen as last drawn, kept between frames so that only what changed is drawn again. Null if the
+  // renderer cannot draw to textures, in which case everything is drawn every frame.
+  SDL_Texture* screen_;
+  // The part of each player's board the screen shows, and the color each cell of it shows, including the falling
+  // piece, or -1 if the cell must be drawn. A cell size of 0 draws everything again.
+  struct ShownBoard {
+    int left;
+    int top;
+    int columns;
+    int rows;
+    int cell_size;
+    std::vector<int> cells;
+  };
+  std::vector<ShownBoard> shown_;
+  // The lines, level and next piece each player's status panel shows.
+  std::vector<std::array<int, 3>> shown_status_;
 };
 
-void GameLoop(GameContext* ctx) {
-  SDL_Event e;
-  Uint64 last_frame_ms = SDL_GetTicks();
-  while (!ctx->IsGameOver()) {
-    bool changed = false;
-    while (SDL_PollEvent(&e)) {
-      switch(e.type) {
-        case SDL_KEYDOWN:
-          switch (e.key.keysym.sym) {
-            case SDLK_ESCAPE:
-            case SDLK_q:
-              return;
-            case SDLK_p:
-              ctx->Pause();
-              break;
-            case SDLK_F1:
-              ctx->PlayMusic(GameContext::Songs::KOROBEINIKI, -1);
-              break;
-            case SDLK_F2:
-              ctx->PlayMusic(GameContext::Songs::BWV814MENUET, -1);
-              break;
-            case SDLK_F3:
-              ctx->PlayMusic(GameContext::Songs::RUSSIANSONG, -1);
-              break;
+// Runs a game on its own thread at a fixed tick rate, taking inputs from the render thread and publishing a snapshot
+// whenever the game changes. Presenting a frame, which can block for a whole refresh with vsync, never delays a
+// tick or an input, and a slow tick never delays drawing. The thread also records the replay, and ends it when the
+// game is over or the thread is told to quit.
+//
+// Or it runs the local player's side of a versus match, exchanging inputs with the peer on every tick and rolling
+// back when they were not the ones predicted, all within the tick.
+//
+// A snapshot holds only the part of the board the render thread shows, which it picks with the view commands. The
+// view follows the falling piece until it is scrolled, so that publishing a frame of a board of millions of cells
+// copies only the cells on the screen.
+class LogicThread {
+ public:
+  // Each publish pushes an SDL event of type frame_event, unless one is already waiting to be handled, so the render
+  // thread can sleep in SDL_WaitEvent().
+  LogicThread(Game* const game, ReplayWriter* const replay, TripleBuffer<Snapshot>* const snapshots,
+              const Uint32 frame_event, const int framerate=60)
+   : LogicThread(game, replay, nullptr, nullptr, snapshots, frame_event, framerate) {
+  }
+
+  LogicThread(RollbackSession* const session, VersusLink* const link, TripleBuffer<Snapshot>* const snapshots,
+              const Uint32 frame_event, const int framerate=60)
+   : LogicThread(nullptr, nullptr, session, link, snapshots, frame_event, framerate) {
+  }
+
+  ~LogicThread() {
+    Quit();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Also sends the local player's game to spectators each time it is published. Call before Start().
+  void Broadcast(SpectatorServer* const spectators) {
+    spectators_ = spectators;
+  }
+
+  // Shows columns by rows cells of the board, or all of a smaller board, each cell_size pixels square.
+  void ResizeView(const int columns, const int rows, const int cell_size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    view_request_.columns = columns;
+    view_request_.rows = rows;
+    view_request_.cell_size = cell_size;
+    RequestView();
+  }
+
+  // Moves the view dx columns right and dy rows down, as far as the edges of the board, and stops it following the
+  // falling piece.
+  void ScrollView(const int dx, const int dy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    view_request_.dx += dx;
+    view_request_.dy += dy;
+    view_request_.follow = false;
+    RequestView();
+  }
+
+  // Keeps the falling piece in view again.
+  void FollowPiece() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    view_request_.follow = true;
+    RequestView();
+  }
+
+  // Publishes the game as it is and starts running it.
+  void Start() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      TakeView();
+    }
+    Publish();
+    thread_ = std::thread(&LogicThread::Run, this);
+  }
+
+  // Queues an input for the next tick, or a pause. dequeued is when its event was taken off the SDL queue.
+  void Send(const Game::Input input, const Uint64 dequeued) {
+    Queue(Command{.pause=false, .input=input, .dequeued=dequeued});
+  }
+
+  void SendPause() {
+    Queue(Command{.pause=true, .input=Game::Input::MOVE_LEFT, .dequeued=0});
+  }
+
+  void Quit() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+    wake_.notify_one();
+  }
+
+  // Called by the render thread on taking a frame event, before fetching the snapshot, so that any later publish
+  // pushes another.
+  void FrameReceived() {
+    frame_pending_.exchange(false, std::memory_order_acq_rel);
+  }
+
+  // Moves the dequeue times of the inputs that changed the game, up to and including the input numbered applied,
+  // to dequeued.
+  void TakeChanged(const uint64_t applied, std::vector<Uint64>* const dequeued) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t taken = 0;
+    for (; taken < changed_.size() && changed_[taken].sequence <= applied; ++taken) {
+      dequeued->push_back(changed_[taken].dequeued);
+    }
+    changed_.erase(changed_.begin(), changed_.begin() + taken);
+  }
+
+ private:
+  // A match ends when the peer has not been heard from for PEER_TIMEOUT. After both players agree the match is
+  // over, the thread keeps sending for up to LINGER until the peer has every local frame, so that it sees the
+  // same end.
+  static constexpr std::chrono::seconds PEER_TIMEOUT{5};
+  static constexpr std::chrono::seconds LINGER{2};
+
+  LogicThread(Game* const game, ReplayWriter* const replay, RollbackSession* const session, VersusLink* const link,
+              TripleBuffer<Snapshot>* const snapshots, const Uint32 frame_event, const int framerate)
+   : game_(game),
+     replay_(replay),
+     session_(session),
+     link_(link),
+     snapshots_(snapshots),
+     spectators_(nullptr),
+     frame_event_(frame_event),
+     clock_(framerate),
+     frame_pending_(false),
+     sent_(0),
+     quit_(false),
+     view_request_{.columns=0, .rows=0, .cell_size=0, .dx=0, .dy=0, .follow=true, .changed=false},
+     applied_(0),
+     peer_left_(false),
+     linger_until_(),
+     view_() {
+  }
+
+  struct Command {
+    bool pause;
+    Game::Input input;
+    Uint64 dequeued;
+    uint64_t sequence;
+  };
+
+  void Queue(Command command) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    command.sequence = ++sent_;
+    inputs_.push_back(command);
+    wake_.notify_one();
+  }
+
+  // Called with mutex_ held.
+  void RequestView() {
+    view_request_.changed = true;
+    wake_.notify_one();
+  }
+
+  // Takes the view the render thread asked for. Called with mutex_ held. Returns whether it asked for a change.
+  bool TakeView() {
+    if (!view_request_.changed) {
+      return false;
+    }
+    view_.columns = view_request_.columns;
+    view_.rows = view_request_.rows;
+    view_.cell_size = view_request_.cell_size;
+    view_.left += view_request_.dx;
+    view_.top += view_request_.dy;
+    view_.follow = view_request_.follow;
+    view_request_.dx = 0;
+    view_request_.dy = 0;
+    view_request_.changed = false;
+    return true;
+  }
+
+  // Fits the view to the board, and moves it to the falling piece when following it and the piece is near an edge.
+  void PlaceView(const Game& game) {
+    const int columns = std::min(view_.columns, game.width());
+    const int rows = std::min(view_.rows, game.height());
+    if (view_.follow) {
+      // The piece's bounding box is at most 4 cells, so a margin of that keeps it and some of its surroundings in
+      // view, while the view moves only every few rows of a fall.
+      const int margin_x = std::min(4, (columns - 1) / 2);
+      const int margin_y = std::min(4, (rows - 1) / 2);
+      view_.left = std::clamp(view_.left, game.current_x() + margin_x - columns + 1, game.current_x() - margin_x);
+      view_.top = std::clamp(view_.top, game.current_y() + margin_y - rows + 1, game.current_y() - margin_y);
+    }
+    view_.left = std::clamp(view_.left, 0, game.width() - columns);
+    view_.top = std::clamp(view_.top, 0, game.height() - rows);
+  }
+
+  void Run() {
+    // Swapped with inputs_, so that the commands are applied without holding the lock.
+    std::vector<Command> commands;
+    // Inputs that changed the game, moved to changed_ before the snapshot showing them is published.
+    std::vector<Command> changed;
+    std::unique_lock<std::mutex> lock(mutex_);
+    clock_.Reset();
+    while (!quit_ && !Finished()) {
+      {
+        PROFILE_SCOPE("Wait");
+        // Sleep until the next tick is due or there is input. A paused game has nothing to tick, so it sleeps until
+        // there is input.
+        auto woken = [this]() { return quit_ || !inputs_.empty() || view_request_.changed; };
+        if (session_ || game_->IsInPlay()) {
+          wake_.wait_until(lock, clock_.Next(), woken);
+        } else {
+          wake_.wait(lock, woken);
+        }
+      }
+      commands.swap(inputs_);
+      bool update = TakeView();
+      lock.unlock();
+
+      for (const Command& command : commands) {
+        if (session_) {
+          // A match cannot be paused.
+          if (!command.pause && session_->Input(command.input)) {
+            changed.push_back(command);
+            update = true;
           }
-          break;
-        case SDL_QUIT:
-          return;
+        } else if (command.pause) {
+          replay_->Pause(*game_);
+          game_->Pause();
+          // Resume without catching up on the time spent paused.
+          clock_.Reset();
+        } else {
+          // Inputs are recorded whether or not they change the game, so that replaying them makes the same calls.
+          replay_->Input(*game_, command.input);
+          if (game_->HandleInput(command.input)) {
+            changed.push_back(command);
+            update = true;
+          }
+        }
+        applied_ = command.sequence;
       }
-      if (ctx->IsInPlay()) {
-        switch(e.type) {
-          case SDL_KEYDOWN:
-            switch (e.key.keysym.sym) {
-              case SDLK_LEFT:
-                if (!ctx->CollisionDetected(-1, 0)) {
-                  changed = true;
-                  ctx->MoveTetromino(-1, 0);
-                }
-                break;
-              case SDLK_RIGHT:
-                if (!ctx->CollisionDetected(1, 0)) {
-                  changed = true;
-                  ctx->MoveTetromino(1, 0);
-                }
-                break;
-              case SDLK_DOWN:
-                if (!ctx->CollisionDetected(0, 1)) {
-                  changed = true;
-                  ctx->MoveTetromino(0, 1);
-                }
-                break;
-              case SDLK_SPACE:
-                while (!ctx->CollisionDetected(0, 1)) {
-                  changed = true;
-                  ctx->MoveTetromino(0, 1);
-                }
-                break;
-              case SDLK_UP:
-                changed = ctx->Rotate();
-                break;
-              default:
-                break;
-            }
+      commands.clear();
+      if (session_) {
+        for (int due = clock_.Due(); due > 0; --due) {
+          update |= PlayFrame();
         }
+      } else if (game_->IsInPlay()) {
+        for (int due = clock_.Due(); due > 0; --due) {
+          update |= game_->Tick();
+          replay_->Tick(*game_);
+        }
+      }
+
+      lock.lock();
+      changed_.insert(changed_.end(), changed.begin(), changed.end());
+      changed.clear();
+      // Publishing copies the view into the snapshot, which needs no lock; holding it would stall the render thread's
+      // inputs behind the copy. The lock is taken again for the loop's check of quit_ and the wait.
+      lock.unlock();
+      if (update) {
+        Publish();
       }
+      lock.lock();
     }
-    if (ctx->IsInPlay()) {
-      if (ctx->DropCheck()) {
-        changed = true;
-        if (!ctx->CollisionDetected(0, 1)) {
-          ctx->MoveTetromino(0, 1);
-        } else {
-          ctx->ClearBoard();
-          ctx->AddBoardPiece();
-        }
+    lock.unlock();
+    if (replay_) {
+      replay_->End(*game_);
+    }
+    if (Finished()) {
+      Publish();
+    }
+  }
+
+  // Takes what the peer sent, rolls back if it has to, ends the present frame when it should and sends the local
+  // inputs. Returns whether the match changed.
+  bool PlayFrame() {
+    link_->Receive(session_);
+    bool changed = session_->Reconcile() > 0;
+    if (session_->ShouldAdvance()) {
+      changed |= session_->Advance();
+    }
+    link_->Send(*session_);
+    return changed;
+  }
+
+  // Whether the game is over, or the match and any lingering after it are.
+  bool Finished() {
+    if (!session_) {
+      return game_->IsGameOver();
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now - link_->last_received() > PEER_TIMEOUT) {
+      peer_left_ = true;
+      return true;
+    }
+    if (!session_->confirmed().IsOver()) {
+      return false;
+    }
+    if (linger_until_ == std::chrono::steady_clock::time_point()) {
+      linger_until_ = now + LINGER;
+    }
+    return session_->acked() + 1 >= session_->present() || now >= linger_until_;
+  }
+
+  // Fills a player's part of a snapshot from their game, the cells of the view only.
+  void PublishGame(const Game& game, Snapshot::Player* const snapshot) {
+    PlaceView(game);
+    snapshot->left = view_.left;
+    snapshot->top = view_.top;
+    snapshot->columns = std::min(view_.columns, game.width());
+    snapshot->rows = std::min(view_.rows, game.height());
+    snapshot->cell_size = view_.cell_size;
+    snapshot->cells.resize(snapshot->columns * snapshot->rows);
+    game.Render(snapshot->left, snapshot->top, snapshot->columns, snapshot->rows, snapshot->cells.data());
+    snapshot->lines = game.completed_lines();
+    snapshot->level = game.level();
+    snapshot->next_piece = game.next_piece();
+  }
+
+  // Copies the game, or both games of the match, into the back snapshot and publishes it. A match shows what the
+  // local player predicts until both players agree it is over.
+  void Publish() {
+    PROFILE_SCOPE("Publish");
+    Snapshot& snapshot = snapshots_->back();
+    if (session_) {
+      const bool over = session_->confirmed().IsOver();
+      const Match& match = over ? session_->confirmed() : session_->match();
+      const int local = session_->local_player();
+      PublishGame(match.game(local), &snapshot.players[0]);
+      PublishGame(match.game(1 - local), &snapshot.players[1]);
+      snapshot.game_over = over || peer_left_;
+      snapshot.message = !over ? "The other player left" : match.winner() == local ? "You win" :
+                         match.winner() < 0 ? "Draw" : "You lose";
+      if (spectators_) {
+        spectator_view_.From(match.game(local));
+      }
+    } else {
+      PublishGame(*game_, &snapshot.players[0]);
+      snapshot.game_over = game_->IsGameOver();
+      snapshot.message = "The only winning move is not to play";
+      if (spectators_) {
+        spectator_view_.From(*game_);
       }
     }
-    if (changed) {
-      ctx->DrawScreen();
+    if (spectators_) {
+      spectators_->Publish(spectator_view_);
+    }
+    snapshot.inputs_applied = applied_;
+    snapshots_->Publish();
+    if (!frame_pending_.exchange(true, std::memory_order_acq_rel)) {
+      SDL_Event e = {};
+      e.type = frame_event_;
+      SDL_PushEvent(&e);
     }
-    ctx->TimeKeep(SDL_GetTicks(), &last_frame_ms);
-    SDL_Delay(1);
   }
 
-  // Game over.
-  ctx->PlayMusic(GameContext::Songs::GAMEOVERSONG, 0);
-  ctx->DrawScreen();
-  while (true) {
-    while (SDL_PollEvent(&e)) {
-      switch(e.type) {
-        case SDL_KEYDOWN:
-          switch (e.key.keysym.sym) {
-            case SDLK_ESCAPE:
-            case SDLK_q:
-              return;
+  // A game and its replay, or a match.
+  Game* const game_;
+  ReplayWriter* const replay_;
+  RollbackSession* const session_;
+  VersusLink* const link_;
+  TripleBuffer<Snapshot>* const snapshots_;
+  SpectatorServer* spectators_;
+  const Uint32 frame_event_;
+  TickClock clock_;
+  // Whether a frame event has been pushed and not yet handled.
+  std::atomic<bool> frame_pending_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  // Guarded by mutex_: inputs not yet applied, inputs applied whose snapshot the render thread has not presented,
+  // the number of inputs sent, whether to stop, and the view asked for since the logic thread last took it, with
+  // the scrolling asked for added up.
+  std::vector<Command> inputs_;
+  std::vector<Command> changed_;
+  uint64_t sent_;
+  bool quit_;
+  struct {
+    int columns;
+    int rows;
+    int cell_size;
+    int dx;
+    int dy;
+    bool follow;
+    bool changed;
+  } view_request_;
+  // Only used by the logic thread.
+  uint64_t applied_;
+  bool peer_left_;
+  std::chrono::steady_clock::time_point linger_until_;
+  // The part of the board published: columns by rows cells from (left,top), at most.
+  struct {
+    int left;
+    int top;
+    int columns;
+    int rows;
+    int cell_size;
+    bool follow;
+  } view_;
+  GameView spectator_view_;
+  std::thread thread_;
+};
+
+// Cells scrolled for each notch of the mouse wheel.
+const int WHEEL_CELLS = 3;
+
+// Tells the logic thread how much of the board fits at the present zoom.
+void ResizeView(const GameContext& ctx, LogicThread* const logic) {
+  logic->ResizeView(ctx.view_columns(), ctx.view_rows(), ctx.cell_size());
+}
+
+// Handles events and draws each snapshot the logic thread publishes, until the player quits.
+void GameLoop(GameContext* ctx, LogicThread* logic, TripleBuffer<Snapshot>* snapshots, const Uint32 frame_event) {
+  std::vector<Uint64> presented;
+  bool game_over = false;
+  SDL_Event e;
+  // Nothing changes without an event, so wait for one without a timeout.
+  while (SDL_WaitEvent(&e)) {
+    PROFILE_SCOPE("Event");
+    const Uint64 dequeued = SDL_GetPerformanceCounter();
+    if (e.type == frame_event) {
+      logic->FrameReceived();
+      if (!snapshots->Fetch()) {
+        continue;
+      }
+      const Snapshot& snapshot = snapshots->front();
+      logic->TakeChanged(snapshot.inputs_applied, &presented);
+      for (const Uint64 input : presented) {
+        ctx->InputChanged(input);
+      }
+      presented.clear();
+      ctx->DrawScreen(snapshot);
+      if (snapshot.game_over && !game_over) {
+        game_over = true;
+        ctx->PlayMusic(GameContext::Songs::GAMEOVERSONG, 0);
+      }
+      continue;
+    }
+    switch(e.type) {
+      case SDL_KEYDOWN:
+        switch (e.key.keysym.sym) {
+          case SDLK_ESCAPE:
+          case SDLK_q:
+            return;
+          case SDLK_p:
+            logic->SendPause();
+            break;
+          case SDLK_F1:
+            ctx->PlayMusic(GameContext::Songs::KOROBEINIKI, -1);
+            break;
+          case SDLK_F2:
+            ctx->PlayMusic(GameContext::Songs::BWV814MENUET, -1);
+            break;
+          case SDLK_F3:
+            ctx->PlayMusic(GameContext::Songs::RUSSIANSONG, -1);
+            break;
+          case SDLK_F12:
+            ctx->PrintLatency();
+            break;
+          case SDLK_LEFT:
+            logic->Send(Game::Input::MOVE_LEFT, dequeued);
+            break;
+          case SDLK_RIGHT:
+            logic->Send(Game::Input::MOVE_RIGHT, dequeued);
+            break;
+          case SDLK_DOWN:
+            logic->Send(Game::Input::MOVE_DOWN, dequeued);
+            break;
+          case SDLK_SPACE:
+            logic->Send(Game::Input::DROP, dequeued);
+            break;
+          case SDLK_UP:
+            logic->Send(Game::Input::ROTATE, dequeued);
+            break;
+          case SDLK_PAGEUP:
+            logic->ScrollView(0, -ctx->view_rows() / 2);
+            break;
+          case SDLK_PAGEDOWN:
+            logic->ScrollView(0, ctx->view_rows() / 2);
+            break;
+          case SDLK_f:
+            logic->FollowPiece();
+            break;
+          case SDLK_PLUS:
+          case SDLK_EQUALS:
+          case SDLK_KP_PLUS:
+            if (ctx->Zoom(1)) {
+              ResizeView(*ctx, logic);
+            }
+            break;
+          case SDLK_MINUS:
+          case SDLK_KP_MINUS:
+            if (ctx->Zoom(-1)) {
+              ResizeView(*ctx, logic);
+            }
+            break;
+        }
+        break;
+      case SDL_MOUSEWHEEL: {
+        // Wheel up and right are positive. Ctrl zooms, and shift turns scrolling down into scrolling right.
+        const int flip = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
+        const int x = flip*e.wheel.x;
+        const int y = flip*e.wheel.y;
+        const SDL_Keymod mod = SDL_GetModState();
+        if (mod & KMOD_CTRL) {
+          if (ctx->Zoom(y)) {
+            ResizeView(*ctx, logic);
           }
-          break;
-        case SDL_QUIT:
-          return;
+        } else if (mod & KMOD_SHIFT) {
+          logic->ScrollView(-WHEEL_CELLS*y, 0);
+        } else {
+          logic->ScrollView(WHEEL_CELLS*x, -WHEEL_CELLS*y);
+        }
+        break;
       }
+      case SDL_RENDER_TARGETS_RESET:
+        ctx->Invalidate();
+        ctx->DrawScreen(snapshots->front());
+        break;
+      case SDL_QUIT:
+        return;
     }
-    SDL_Delay(10);
   }
 }
 
 int main(int argc, char** argv) {
   unsigned long level = 0;
-  if (argc > 1) {
-    level = strtoul(argv[1], nullptr, 0);
+  uint64_t seed = time(nullptr);
+  PieceGenerator::Policy pieces = PieceGenerator::Policy::UNIFORM;
+  const char* replay_path = "tetris.replay";
+  const char* assets_path = nullptr;
+  int opt;
+  bool startup_times = false;
+  bool print_latency = false;
+  const char* trace_path = nullptr;
+  const char* versus = nullptr;
+  int spectate_port = 0;
+  int width = 10;
+  int height = 20;
+  while ((opt = getopt(argc, argv, "s:br:ta:lP:V:S:W:")) != -1) {
+    switch (opt) {
+      case 's':
+        seed = strtoull(optarg, nullptr, 0);
+        break;
+      case 'b':
+        pieces = PieceGenerator::Policy::BAG;
+        break;
+      case 'r':
+        replay_path = optarg;
+        break;
+      case 't':
+        startup_times = true;
+        break;
+      case 'a':
+        assets_path = optarg;
+        break;
+      case 'l':
+        print_latency = true;
+        break;
+      case 'P':
+        trace_path = optarg;
+        break;
+      case 'V':
+        versus = optarg;
+        break;
+      case 'S':
+        spectate_port = strtol(optarg, nullptr, 0);
+        break;
+      case 'W':
+        if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+          std::cerr << "-W takes WIDTHxHEIGHT, e.g. 1000x2000" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
+    }
+  }
+  if (optind < argc) {
+    level = strtoul(argv[optind], nullptr, 0);
   }
-  srandom(time(nullptr));
 
   std::cout << "\n"
 "TETЯIS: \n\n"
-"  usage: " << *argv << " [level 1-15]\n\n"
+"  usage: " << *argv << " [-s seed] [-b] [-r replay file] [-t] [-a assets] [-l] [-P trace.json]\n"
+"               [-V port:host:port] [-S port] [-W WIDTHxHEIGHT] [level 1-15]\n\n"
+"  -s  - Seed for the pieces, to play the same game again.\n"
+"  -b  - Deal pieces from shuffled bags of all 7.\n"
+"  -r  - Where to record the game (tetris.replay). Verify with tetris-sim -R.\n"
+"  -t  - Print how long each step of startup takes.\n"
+"  -a  - Asset archive (tetris.assets next to the binary, else the files under the current directory).\n"
+"  -l  - Print input to screen latency percentiles on exit.\n"
+"  -P  - Profile each phase of the game and drawing, writing a Chrome trace and printing a summary on exit.\n"
+"  -V  - Play a versus match against the tetris listening on host:port, listening on port. The seed, pieces and\n"
+"        level are those of whichever player becomes player 1. Matches are not recorded.\n"
+"  -S  - Stream the game to spectators on port, who watch with tetris-watch host:port.\n"
+"  -W  - Play on a board this many columns by rows (10x20), up to 4096 columns and 64M cells. A board larger\n"
+"        than the window follows the falling piece. Not for versus matches.\n\n"
 "  F1  - Korobeiniki (gameboy song A).\n"
 "  F2  - Bach french suite No 3 in b minor BWV 814 Menuet (gameboy song B).\n"
 "  F3  - Russion song (gameboy song C).\n"
+"  F12 - Print input to screen latency percentiles.\n"
+"  Wheel, PageUp, PageDown - Scroll a large board, shift+wheel across. f - Follow the falling piece again.\n"
+"  Ctrl+wheel, +, - - Zoom.\n"
 "  ESC - Quit.\n"
 "  p   - Pause.\n\n"
 "  Up - Rotate.\n"
 "  Down - Lower.\n"
-"  Space - Drop completely.\n\n";
+"  Space - Drop completely.\n\n"
+"  Seed: " << seed << "\n\n";
+
+  if (trace_path) {
+    Profiler::Enable();
+  }
+  StartupTimer startup(startup_times);
+  AssetArchive assets;
+  std::string error;
+#ifdef TETRIS_EMBED_ASSETS
+  if (!assets_path && !assets.Attach(_binary_tetris_assets_start,
+                                     _binary_tetris_assets_end - _binary_tetris_assets_start, &error)) {
+    std::cerr << "Embedded assets: " << error << std::endl;
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if (assets_path) {
+    if (!assets.Map(assets_path, &error)) {
+      std::cerr << assets_path << ": " << error << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  } else if (assets.empty()) {
+    // Installed next to the binary, so the game runs from any directory. Without it, the loose files are used.
+    char* const base = SDL_GetBasePath();
+    if (base) {
+      assets.Map((std::string(base) + "tetris.assets").c_str(), &error);
+      SDL_free(base);
+    }
+  }
+  startup.Mark("Map assets");
+  if (versus && (width != 10 || height != 20)) {
+    std::cerr << "A versus match is played on a 10x20 board" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (width < 1 || width > Board::MAX_WIDTH || height < 1 || static_cast<long>(width)*height > Board::MAX_CELLS) {
+    std::cerr << "-W " << width << "x" << height << ": the board is at most " << Board::MAX_WIDTH
+              << " columns and " << Board::MAX_CELLS << " cells" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  VersusLink link;
+  int player = 0;
+  if (versus) {
+    char host[256];
+    int port, peer_port;
+    if (sscanf(versus, "%d:%255[^:]:%d", &port, host, &peer_port) != 3) {
+      std::cerr << "-V takes port:host:port, e.g. 7001:localhost:7002" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::cout << "Waiting for the other player at " << host << ":" << peer_port << "...\n";
+    VersusSettings settings = {.seed=seed, .pieces=pieces, .level=static_cast<int>(level)};
+    if (!link.Open(port, host, peer_port, &error) || !link.Handshake(&settings, &player, 60000, &error)) {
+      std::cerr << "Versus: " << error << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    seed = settings.seed;
+    pieces = settings.pieces;
+    level = settings.level;
+    std::cout << "Player " << player + 1 << ", seed " << seed << "\n";
+    startup.Mark("Versus handshake");
+  }
+
+  SpectatorServer spectators;
+  if (spectate_port && !spectators.Start(spectate_port, &error)) {
+    std::cerr << "Spectators: " << error << std::endl;
+    exit(EXIT_FAILURE);
+  }
 
-  GameContext ctx(level);
-  ctx.AddBoardPiece();
-  ctx.DrawScreen();
-  GameLoop(&ctx);
+  // The two boards of a match fit side by side with smaller blocks.
+  const int players = versus ? 2 : 1;
+  // A larger board is shown through a window of at most 10x20 blocks.
+  GameContext ctx(&startup, &assets, std::min(width, 10), std::min(height, 20), versus ? 48 : 96, players);
+  std::unique_ptr<Game> game;
+  std::unique_ptr<ReplayWriter> replay;
+  std::unique_ptr<RollbackSession> session;
+  if (versus) {
+    session = std::make_unique<RollbackSession>(Match(level, width, height, PieceGenerator(seed, pieces)), player);
+  } else {
+    game = std::make_unique<Game>(level, width, height, PieceGenerator(seed, pieces));
+    const ReplayHeader header = {.seed=seed, .policy=pieces, .level=static_cast<int>(level), .width=width,
+                                 .height=height, .keyframe_interval=REPLAY_KEYFRAME_INTERVAL};
+    replay = std::make_unique<ReplayWriter>(replay_path, header);
+    if (!replay->ok()) {
+      std::cerr << "Cannot record the game to " << replay_path << ": " << strerror(errno) << "\n";
+    }
+    game->AddBoardPiece();
+  }
+  TripleBuffer<Snapshot> snapshots(Snapshot{.players=std::vector<Snapshot::Player>(players)});
+  const Uint32 frame_event = SDL_RegisterEvents(1);
+  if (frame_event == static_cast<Uint32>(-1)) {
+    std::cerr << "SDL_RegisterEvents: out of user events" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  {
+    std::unique_ptr<LogicThread> logic =
+        versus ? std::make_unique<LogicThread>(session.get(), &link, &snapshots, frame_event)
+               : std::make_unique<LogicThread>(game.get(), replay.get(), &snapshots, frame_event);
+    if (spectate_port) {
+      logic->Broadcast(&spectators);
+    }
+    ResizeView(ctx, logic.get());
+    logic->Start();
+    snapshots.Fetch();
+    ctx.DrawScreen(snapshots.front());
+    startup.Mark("First frame");
+    GameLoop(&ctx, logic.get(), &snapshots, frame_event);
+    // Leaving the scope stops the logic thread, which ends the replay.
+  }
+  if (print_latency) {
+    ctx.PrintLatency();
+  }
+  if (session) {
+    PrintRollbackStats(session->stats());
+  }
+  if (spectate_port) {
+    spectators.Stop();
+    spectators.PrintStats();
+  }
+  if (trace_path) {
+    std::string error;
+    if (!Profiler::WriteChromeTrace(trace_path, &error)) {
+      std::cerr << error << std::endl;
+    }
+    Profiler::PrintSummary();
+  }
   return EXIT_SUCCESS;
 }
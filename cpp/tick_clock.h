@@ -0,0 +1,54 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// A fixed schedule of game ticks.
+
+#ifndef TETRIS_TICK_CLOCK_H_
+#define TETRIS_TICK_CLOCK_H_
+
+#include <chrono>
+#include <cstdint>
+
+// Ticks run on a fixed schedule: tick n is due n/rate seconds after the schedule starts, so rounding never
+// accumulates into drift.
+class TickClock {
+ public:
+  explicit TickClock(const int rate)
+   : rate_(rate) {
+    Reset();
+  }
+
+  void Reset() {
+    start_ = std::chrono::steady_clock::now();
+    ticks_ = 0;
+  }
+
+  // Returns the number of ticks due, advancing the schedule past them. After a stall of more than MAX_LATE_TICKS,
+  // the schedule restarts from now rather than running the game fast to catch up.
+  int Due() {
+    const auto now = std::chrono::steady_clock::now();
+    int due = 0;
+    while (now >= TickTime(ticks_ + 1)) {
+      ++ticks_;
+      if (++due == MAX_LATE_TICKS) {
+        Reset();
+        break;
+      }
+    }
+    return due;
+  }
+
+  std::chrono::steady_clock::time_point Next() const { return TickTime(ticks_ + 1); }
+
+ private:
+  std::chrono::steady_clock::time_point TickTime(const uint64_t tick) const {
+    return start_ + std::chrono::nanoseconds(tick*1000000000/rate_);
+  }
+
+  static const int MAX_LATE_TICKS = 10;
+  const int rate_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t ticks_;
+};
+
+#endif  // TETRIS_TICK_CLOCK_H_
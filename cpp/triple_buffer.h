@@ -0,0 +1,64 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Passing the latest value from one thread to another without locks.
+
+#ifndef TETRIS_TRIPLE_BUFFER_H_
+#define TETRIS_TRIPLE_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Three copies of a value shared by one writer and one reader. The writer fills the back copy and publishes it, and
+// the reader takes the most recently published copy to the front. Neither ever waits for the other: publishing
+// swaps the back copy with the middle one, and fetching swaps the middle copy with the front one, each with a
+// single atomic exchange. Values published faster than the reader fetches them are skipped, never queued.
+//
+// The copies are never freed or reallocated, so a value that holds buffers, such as a vector sized once, costs
+// no allocations after construction.
+template <typename T>
+class TripleBuffer {
+ public:
+  explicit TripleBuffer(const T& initial=T())
+   : slots_{initial, initial, initial},
+     back_(0),
+     middle_(1),
+     front_(2) {
+  }
+
+  // The copy the writer fills. It holds whatever was published two or more times ago, so the writer must set all
+  // of it.
+  T& back() { return slots_[back_]; }
+
+  // Makes the back copy the latest value, and gives the writer another copy to fill.
+  void Publish() {
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+  }
+
+  // Takes the latest published value to the front, if there is one the reader has not fetched. Returns whether
+  // the front copy changed.
+  bool Fetch() {
+    if (!(middle_.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  // The copy the reader last fetched, which the writer does not touch until the next Fetch().
+  const T& front() const { return slots_[front_]; }
+
+ private:
+  // The middle index is or'd with FRESH when it was published and not yet fetched.
+  static const uint8_t INDEX = 3;
+  static const uint8_t FRESH = 4;
+
+  T slots_[3];
+  // Each slot index is owned by exactly one of back_, middle_ and front_. The writer owns back_ and the reader owns
+  // front_.
+  uint8_t back_;
+  std::atomic<uint8_t> middle_;
+  uint8_t front_;
+};
+
+#endif  // TETRIS_TRIPLE_BUFFER_H_
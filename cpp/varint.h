@@ -0,0 +1,43 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Variable-length integer encoding for compact binary streams.
+
+#ifndef TETRIS_VARINT_H_
+#define TETRIS_VARINT_H_
+
+#include <cstdint>
+#include <vector>
+
+// Appends v 7 bits at a time, low bits first, with the high bit of each byte set when more bytes follow.
+inline void PutVarint(std::vector<uint8_t>* const out, uint64_t v) {
+  while (v >= 0x80) {
+    out->push_back(v | 0x80);
+    v >>= 7;
+  }
+  out->push_back(v);
+}
+
+// Reads a varint at *p, advancing *p past it. Returns false if the encoding runs past end.
+inline bool GetVarint(const uint8_t** const p, const uint8_t* const end, uint64_t* const v) {
+  *v = 0;
+  for (int shift = 0; *p < end && shift < 64; shift += 7) {
+    const uint8_t byte = *(*p)++;
+    *v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Maps signed values to unsigned so that small magnitudes of either sign encode in few bytes.
+inline uint64_t ZigZag(const int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t UnZigZag(const uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+#endif  // TETRIS_VARINT_H_
@@ -0,0 +1,345 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Two-player versus over UDP, with rollback.
+
+#include "versus.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "profile.h"
+#include "varint.h"
+
+Match::Match(const int level, const int width, const int height, const PieceGenerator& generator)
+ : games_{Game(level, width, height, generator), Game(level, width, height, generator)},
+   frames_(0) {
+  games_[0].AddBoardPiece();
+  games_[1].AddBoardPiece();
+}
+
+bool Match::Tick() {
+  // Frames after the end are not played, so the match after them is the match at the end, whoever predicted them.
+  if (IsOver()) {
+    return false;
+  }
+  ++frames_;
+  const bool changed = games_[0].Tick();
+  return games_[1].Tick() || changed;
+}
+
+void Match::CopyFrom(const Match& other) {
+  games_[0].CopyFrom(other.games_[0]);
+  games_[1].CopyFrom(other.games_[1]);
+  frames_ = other.frames_;
+}
+
+RollbackSession::RollbackSession(const Match& start, const int local_player)
+ : local_player_(local_player),
+   match_(start),
+   history_(HISTORY, start),
+   local_(),
+   remote_(),
+   present_(start.frames() + 1),
+   remote_frames_(start.frames()),
+   acked_(start.frames()),
+   remote_present_(present_),
+   remote_advantage_(0),
+   mispredicted_(0),
+   reports_(0),
+   waited_report_(0) {
+}
+
+bool RollbackSession::Input(const Game::Input input) {
+  FrameInputs& frame = local_[Slot(present_)];
+  if (frame.count == FrameInputs::MAX_INPUTS) {
+    return false;
+  }
+  frame.inputs[frame.count++] = input;
+  return match_.Input(local_player_, input);
+}
+
+bool RollbackSession::ShouldAdvance() {
+  if (match_.IsOver() || present_ > remote_frames_ + MAX_PREDICTED || present_ > acked_ + MAX_PREDICTED) {
+    return false;
+  }
+  // Both advantages are as old as the report, so the difference between them is twice how far the local clock is
+  // ahead of the peer's.
+  if (advantage() - remote_advantage_ >= 2 && waited_report_ != reports_) {
+    waited_report_ = reports_;
+    return false;
+  }
+  return true;
+}
+
+bool RollbackSession::Advance() {
+  PROFILE_SCOPE("Advance");
+  bool changed = false;
+  if (present_ <= remote_frames_) {
+    const FrameInputs& remote = remote_[Slot(present_)];
+    for (int i = 0; i < remote.count; ++i) {
+      changed |= match_.Input(1 - local_player_, remote.inputs[i]);
+    }
+  }
+  changed |= match_.Tick();
+  history_[Slot(present_)].CopyFrom(match_);
+  ++present_;
+  local_[Slot(present_)].count = 0;
+  ++stats_.frames;
+  return changed;
+}
+
+void RollbackSession::RemoteInputs(const uint64_t frame, const FrameInputs& inputs) {
+  if (frame != remote_frames_ + 1 || frame >= present_ + MAX_PREDICTED) {
+    return;
+  }
+  FrameInputs& remote = remote_[Slot(frame)];
+  remote.count = std::min(inputs.count, FrameInputs::MAX_INPUTS);
+  std::copy(inputs.inputs, inputs.inputs + remote.count, remote.inputs);
+  remote_frames_ = frame;
+  // Frames already ended were played with no remote inputs.
+  if (frame < present_ && remote.count && !mispredicted_) {
+    mispredicted_ = frame;
+  }
+}
+
+void RollbackSession::RemoteStatus(const uint64_t acked, const uint64_t present, const int64_t advantage) {
+  // Reports can arrive out of order, so only ever move forward.
+  if (acked < present_) {
+    acked_ = std::max(acked_, acked);
+  }
+  if (present > remote_present_) {
+    remote_present_ = present;
+    remote_advantage_ = advantage;
+    ++reports_;
+  }
+}
+
+int RollbackSession::Reconcile() {
+  if (!mispredicted_) {
+    return 0;
+  }
+  PROFILE_SCOPE("Rollback");
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t first = mispredicted_;
+  mispredicted_ = 0;
+  match_.CopyFrom(history_[Slot(first - 1)]);
+  const int remote_player = 1 - local_player_;
+  for (uint64_t frame = first; frame < present_; ++frame) {
+    const FrameInputs& local = local_[Slot(frame)];
+    for (int i = 0; i < local.count; ++i) {
+      match_.Input(local_player_, local.inputs[i]);
+    }
+    if (frame <= remote_frames_) {
+      const FrameInputs& remote = remote_[Slot(frame)];
+      for (int i = 0; i < remote.count; ++i) {
+        match_.Input(remote_player, remote.inputs[i]);
+      }
+    }
+    match_.Tick();
+    history_[Slot(frame)].CopyFrom(match_);
+  }
+  // The local inputs of the present frame were applied as they came, so they are applied again.
+  const FrameInputs& local = local_[Slot(present_)];
+  for (int i = 0; i < local.count; ++i) {
+    match_.Input(local_player_, local.inputs[i]);
+  }
+  const int depth = present_ - first;
+  const uint64_t ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  ++stats_.rollbacks;
+  stats_.resimulated += depth;
+  stats_.max_depth = std::max(stats_.max_depth, depth);
+  stats_.cost.Record(ns);
+  stats_.total_ns += ns;
+  return depth;
+}
+
+VersusLink::~VersusLink() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool VersusLink::Open(const int port, const std::string& host, const int peer_port, std::string* const error) {
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo* peer;
+  int ret = getaddrinfo(host.c_str(), std::to_string(peer_port).c_str(), &hints, &peer);
+  if (ret) {
+    *error = host + ": " + gai_strerror(ret);
+    return false;
+  }
+  // Listen on every address of the peer's family.
+  hints.ai_family = peer->ai_family;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo* local;
+  ret = getaddrinfo(nullptr, std::to_string(port).c_str(), &hints, &local);
+  if (ret) {
+    freeaddrinfo(peer);
+    *error = std::string("local address: ") + gai_strerror(ret);
+    return false;
+  }
+  fd_ = socket(peer->ai_family, SOCK_DGRAM, 0);
+  // Connecting a datagram socket only sets where sends go and filters out datagrams from anywhere else.
+  if (fd_ < 0 || bind(fd_, local->ai_addr, local->ai_addrlen) || connect(fd_, peer->ai_addr, peer->ai_addrlen)) {
+    *error = std::string("port ") + std::to_string(port) + ": " + strerror(errno);
+    freeaddrinfo(local);
+    freeaddrinfo(peer);
+    return false;
+  }
+  freeaddrinfo(local);
+  freeaddrinfo(peer);
+  buffer_.resize(65536);
+  return true;
+}
+
+void VersusLink::SendMessage() {
+  // A datagram the peer is not yet listening for is lost like any other, and sent again.
+  send(fd_, message_.data(), message_.size(), MSG_DONTWAIT);
+}
+
+// A hello says whether this peer has heard the other. A peer that has heard, and been heard, is ready.
+void VersusLink::SendHello(const uint64_t nonce, const bool heard, const VersusSettings& settings) {
+  message_.clear();
+  PutVarint(&message_, HELLO);
+  PutVarint(&message_, nonce);
+  PutVarint(&message_, heard);
+  PutVarint(&message_, settings.seed);
+  PutVarint(&message_, settings.pieces);
+  PutVarint(&message_, settings.level);
+  SendMessage();
+}
+
+bool VersusLink::Handshake(VersusSettings* const settings, int* const local_player, const int timeout_ms,
+                           std::string* const error) {
+  std::random_device device;
+  const uint64_t nonce = static_cast<uint64_t>(device()) << 32 | device();
+  uint64_t peer_nonce = 0;
+  VersusSettings peer_settings = {};
+  bool heard = false;
+  bool done = false;
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  auto next_hello = std::chrono::steady_clock::now();
+  while (!done) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      *error = "no answer from the peer";
+      return false;
+    }
+    if (now >= next_hello) {
+      SendHello(nonce, heard, *settings);
+      next_hello = now + std::chrono::milliseconds(100);
+    }
+    struct pollfd pfd = {.fd=fd_, .events=POLLIN, .revents=0};
+    poll(&pfd, 1, std::chrono::duration_cast<std::chrono::milliseconds>(next_hello - now).count() + 1);
+    ssize_t size;
+    while ((size = recv(fd_, buffer_.data(), buffer_.size(), MSG_DONTWAIT)) >= 0 || errno == ECONNREFUSED) {
+      if (size < 0) {
+        continue;
+      }
+      const uint8_t* p = buffer_.data();
+      const uint8_t* const end = p + size;
+      uint64_t values[6];
+      int count = 0;
+      while (count < 6 && GetVarint(&p, end, &values[count])) {
+        ++count;
+      }
+      if (count >= 1 && values[0] == INPUTS && heard) {
+        // The peer only starts once it has been heard, so it has heard this peer.
+        done = true;
+      } else if (count == 6 && values[0] == HELLO && values[4] <= PieceGenerator::Policy::BAG) {
+        if (!heard) {
+          // Answer at once, so the peer need not wait for the next hello.
+          next_hello = now;
+        }
+        heard = true;
+        peer_nonce = values[1];
+        peer_settings = VersusSettings{.seed=values[3], .pieces=static_cast<PieceGenerator::Policy>(values[4]),
+                                       .level=static_cast<int>(values[5])};
+        done |= values[2] != 0;
+      }
+    }
+  }
+  // The peer may still be waiting to hear that it was heard.
+  SendHello(nonce, true, *settings);
+  if (nonce == peer_nonce) {
+    *error = "both peers chose the same nonce; try again";
+    return false;
+  }
+  *local_player = nonce < peer_nonce ? 0 : 1;
+  if (*local_player == 1) {
+    *settings = peer_settings;
+  }
+  last_received_ = std::chrono::steady_clock::now();
+  return true;
+}
+
+void VersusLink::Send(const RollbackSession& session) {
+  message_.clear();
+  PutVarint(&message_, INPUTS);
+  PutVarint(&message_, session.remote_frames());
+  PutVarint(&message_, session.present());
+  PutVarint(&message_, ZigZag(session.advantage()));
+  const uint64_t first = session.acked() + 1;
+  PutVarint(&message_, first);
+  PutVarint(&message_, session.present() - first);
+  for (uint64_t frame = first; frame < session.present(); ++frame) {
+    const FrameInputs& inputs = session.local_inputs(frame);
+    PutVarint(&message_, inputs.count);
+    message_.insert(message_.end(), inputs.inputs, inputs.inputs + inputs.count);
+  }
+  SendMessage();
+}
+
+void VersusLink::Receive(RollbackSession* const session) {
+  ssize_t size;
+  while ((size = recv(fd_, buffer_.data(), buffer_.size(), MSG_DONTWAIT)) >= 0 || errno == ECONNREFUSED) {
+    if (size < 0) {
+      continue;
+    }
+    last_received_ = std::chrono::steady_clock::now();
+    const uint8_t* p = buffer_.data();
+    const uint8_t* const end = p + size;
+    uint64_t kind, acked, present, advantage, first, frames;
+    // Hellos sent again by a peer that has not yet heard it was heard are answered by the inputs.
+    if (!GetVarint(&p, end, &kind) || kind != INPUTS || !GetVarint(&p, end, &acked) ||
+        !GetVarint(&p, end, &present) || !GetVarint(&p, end, &advantage) || !GetVarint(&p, end, &first) ||
+        !GetVarint(&p, end, &frames)) {
+      continue;
+    }
+    session->RemoteStatus(acked, present, UnZigZag(advantage));
+    for (uint64_t frame = first; frame < first + frames; ++frame) {
+      uint64_t count;
+      FrameInputs inputs;
+      if (!GetVarint(&p, end, &count) || count > FrameInputs::MAX_INPUTS || end - p < static_cast<long>(count)) {
+        break;
+      }
+      inputs.count = count;
+      bool valid = true;
+      for (int i = 0; i < inputs.count; ++i) {
+        valid &= *p <= Game::Input::ROTATE;
+        inputs.inputs[i] = static_cast<Game::Input>(*p++);
+      }
+      if (!valid) {
+        break;
+      }
+      session->RemoteInputs(frame, inputs);
+    }
+  }
+}
+
+void PrintRollbackStats(const RollbackStats& stats) {
+  printf("Rollbacks: %lu in %lu frames (%.1f%%), %.2f frames played again on average, %d at most\n", stats.rollbacks,
+         stats.frames, stats.frames ? 100.0*stats.rollbacks/stats.frames : 0,
+         stats.rollbacks ? static_cast<double>(stats.resimulated)/stats.rollbacks : 0, stats.max_depth);
+  printf("Rollback cost: p50 %.1f us, p99 %.1f us, max %.1f us; %.0f ns per frame played again\n",
+         stats.cost.Percentile(0.50)/1e3, stats.cost.Percentile(0.99)/1e3, stats.cost.max()/1e3,
+         stats.resimulated ? static_cast<double>(stats.total_ns)/stats.resimulated : 0);
+}
@@ -0,0 +1,203 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Two-player versus over UDP, with rollback so that neither player waits for the other's inputs.
+
+#ifndef TETRIS_VERSUS_H_
+#define TETRIS_VERSUS_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "game.h"
+#include "generator.h"
+#include "latency.h"
+
+// The inputs one player made during one frame, the time between two ticks, in order. Inputs past MAX_INPUTS in a
+// frame are dropped; at 60 ticks a second no one presses keys that fast.
+struct FrameInputs {
+  static constexpr int MAX_INPUTS = 7;
+
+  int count;
+  Game::Input inputs[MAX_INPUTS];
+};
+
+// Both players' games, dealt the same pieces. Frame f is each player's inputs followed by tick f of both games, so
+// matches started alike and played with the same inputs are the same match. The games do not interact, so the
+// inputs of one player may be applied before or after those of the other.
+class Match {
+ public:
+  Match(int level, int width, int height, const PieceGenerator& generator);
+
+  // Applies an input of player 0 or 1. Returns whether it changed the player's game. Once the match is over inputs
+  // are ignored, as frames are by Tick(), so the match stays the one at the end.
+  bool Input(const int player, const Game::Input input) {
+    return !IsOver() && games_[player].HandleInput(input);
+  }
+
+  // Ends the frame with a tick of each game. Returns whether either changed.
+  bool Tick();
+
+  // Copies a match of the same board size without allocating.
+  void CopyFrom(const Match& other);
+
+  const Game& game(const int player) const { return games_[player]; }
+  // The number of frames played.
+  uint64_t frames() const { return frames_; }
+
+  // The match is over when a game is. The winner is the player whose game is not over, or -1 when both ended on the
+  // same frame.
+  bool IsOver() const { return games_[0].IsGameOver() || games_[1].IsGameOver(); }
+  int winner() const { return games_[0].IsGameOver() ? (games_[1].IsGameOver() ? -1 : 1) : 0; }
+
+ private:
+  Game games_[2];
+  uint64_t frames_;
+};
+
+// How often and how far a session rolled back, and how long playing the frames again took.
+struct RollbackStats {
+  RollbackStats() : frames(0), rollbacks(0), resimulated(0), max_depth(0), total_ns(0) {}
+
+  // Frames ended by Advance().
+  uint64_t frames;
+  uint64_t rollbacks;
+  // Frames played again, over all rollbacks, and the most in one.
+  uint64_t resimulated;
+  int max_depth;
+  // The time each rollback took, from restoring the match to reaching the present again, and over all rollbacks.
+  LatencyHistogram cost;
+  uint64_t total_ns;
+};
+
+// Plays a match against a remote player without waiting for their inputs. Local inputs apply at once, and frames
+// end on the local clock with the remote player's inputs predicted to be none, as they are in most frames. When the
+// remote inputs of a frame arrive and there were some after all, the session restores the match as it was before that
+// frame and plays it again up to the present with the inputs now known, which is a rollback.
+//
+// The match after each of the last HISTORY frames is kept in a ring of copies made once, so a rollback is a copy
+// and a few ticks, and frames are confirmed, never to be played again, once the remote inputs for them are in.
+class RollbackSession {
+ public:
+  // Frames the present may run ahead of the remote inputs received, or of the local inputs the peer acknowledged,
+  // about a second at 60 ticks a second. Past that the session waits for the peer.
+  static const int MAX_PREDICTED = 60;
+
+  RollbackSession(const Match& start, int local_player);
+
+  int local_player() const { return local_player_; }
+  // The match as the local player sees it, predictions included.
+  const Match& match() const { return match_; }
+  // The last match both players agree on: frames with both players' inputs known.
+  const Match& confirmed() const { return history_[Slot(std::min(remote_frames_, present_ - 1))]; }
+  // The frame local inputs are added to, which the next Advance() ends.
+  uint64_t present() const { return present_; }
+  // Remote inputs are known for frames 1 to remote_frames(), and the peer has those of frames 1 to acked().
+  uint64_t remote_frames() const { return remote_frames_; }
+  uint64_t acked() const { return acked_; }
+  const FrameInputs& local_inputs(const uint64_t frame) const { return local_[Slot(frame)]; }
+  const RollbackStats& stats() const { return stats_; }
+
+  // Applies a local input in the present frame. Returns whether it changed the local game.
+  bool Input(Game::Input input);
+
+  // Whether the present frame should end on this tick. Not while the match is over, or while the peer is
+  // MAX_PREDICTED frames behind. And not every tick while the local clock runs ahead of the peer's, so that the two
+  // meet and rollbacks stay short.
+  bool ShouldAdvance();
+
+  // Ends the present frame. Returns whether the match changed.
+  bool Advance();
+
+  // Takes the remote player's inputs for a frame. Only the frame after the last one received is taken, and none
+  // more than MAX_PREDICTED frames ahead; the peer sends the others again.
+  void RemoteInputs(uint64_t frame, const FrameInputs& inputs);
+
+  // Takes what the peer last reported: the local frames it has received, its present frame, and how far it is
+  // ahead of the local present as it sees it.
+  void RemoteStatus(uint64_t acked, uint64_t present, int64_t advantage);
+
+  // How far the local present is ahead of the peer's last reported present.
+  int64_t advantage() const { return static_cast<int64_t>(present_) - static_cast<int64_t>(remote_present_); }
+
+  // Rolls back if remote inputs received since the last call were not the ones predicted, playing the frames from
+  // the first of them to the present again. Returns the number of frames played again.
+  int Reconcile();
+
+ private:
+  static const int HISTORY = 128;
+
+  static int Slot(const uint64_t frame) { return frame % HISTORY; }
+
+  const int local_player_;
+  Match match_;
+  // The match after each frame, and each player's inputs in each frame, at the slot of the frame.
+  std::vector<Match> history_;
+  FrameInputs local_[HISTORY];
+  FrameInputs remote_[HISTORY];
+  uint64_t present_;
+  uint64_t remote_frames_;
+  uint64_t acked_;
+  uint64_t remote_present_;
+  int64_t remote_advantage_;
+  // The first frame played with a wrong prediction, or 0 if there is none.
+  uint64_t mispredicted_;
+  // The number of reports from the peer, and that number when the session last waited for the peer's clock, so that
+  // it waits at most one tick per report.
+  uint64_t reports_;
+  uint64_t waited_report_;
+  RollbackStats stats_;
+};
+
+// The settings both peers play with, those of player 0.
+struct VersusSettings {
+  uint64_t seed;
+  PieceGenerator::Policy pieces;
+  int level;
+};
+
+// A UDP socket to the other player's peer. Each message carries every local input the peer has not acknowledged,
+// so a lost or reordered datagram needs no retransmission of its own: the next message covers it.
+class VersusLink {
+ public:
+  VersusLink() : fd_(-1) {}
+  ~VersusLink();
+  VersusLink(const VersusLink&) = delete;
+  VersusLink& operator=(const VersusLink&) = delete;
+
+  // Listens on port, and sends to peer_port on host. Returns false and sets error on failure.
+  bool Open(int port, const std::string& host, int peer_port, std::string* error);
+
+  // Waits up to timeout_ms for the peer, then agrees with it on who is player 0, whose settings both peers use.
+  // settings holds the local settings on the way in and the agreed ones on the way out.
+  bool Handshake(VersusSettings* settings, int* local_player, int timeout_ms, std::string* error);
+
+  // Sends the local inputs of the frames the peer has not acknowledged, up to the last one ended.
+  void Send(const RollbackSession& session);
+
+  // Passes every message waiting on the socket to the session.
+  void Receive(RollbackSession* session);
+
+  // When a message from the peer was last received.
+  std::chrono::steady_clock::time_point last_received() const { return last_received_; }
+
+ private:
+  enum Kind {HELLO, INPUTS};
+
+  void SendMessage();
+  void SendHello(uint64_t nonce, bool heard, const VersusSettings& settings);
+
+  int fd_;
+  // The message being sent, and the datagram last received.
+  std::vector<uint8_t> message_;
+  std::vector<uint8_t> buffer_;
+  std::chrono::steady_clock::time_point last_received_;
+};
+
+// Prints how often the session rolled back, how far, and what it cost.
+void PrintRollbackStats(const RollbackStats& stats);
+
+#endif  // TETRIS_VERSUS_H_
@@ -0,0 +1,199 @@
+// Author: Adam Rogoyski (adam@rogoyski.com).
+// Public domain software.
+//
+// Watches a game streamed by tetris -S or tetris-sim -B, drawing it in the terminal. With -n, opens many connections
+// at once instead and reports the rate they receive at, to load the server.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "spectate.h"
+#include "varint.h"
+
+struct Connection {
+  int fd;
+  // Bytes received and not yet decoded.
+  std::vector<uint8_t> buffer;
+  ViewDecoder decoder;
+  uint64_t messages;
+};
+
+int Connect(const struct addrinfo* const address) {
+  const int fd = socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Decodes every whole message in the connection's buffer. Returns the number decoded, or -1 on a bad message.
+int Decode(Connection* const connection) {
+  const uint8_t* p = connection->buffer.data();
+  const uint8_t* const end = p + connection->buffer.size();
+  int decoded = 0;
+  for (;;) {
+    const uint8_t* message = p;
+    uint64_t size;
+    if (!GetVarint(&message, end, &size) || static_cast<uint64_t>(end - message) < size) {
+      break;
+    }
+    if (!connection->decoder.Apply(message, size)) {
+      return -1;
+    }
+    p = message + size;
+    ++decoded;
+  }
+  connection->buffer.erase(connection->buffer.begin(), connection->buffer.begin() + (p - connection->buffer.data()));
+  connection->messages += decoded;
+  return decoded;
+}
+
+void Draw(const GameView& view) {
+  std::string out = "\033[H";
+  for (int y = 0; y < view.height; ++y) {
+    out += '|';
+    for (int x = 0; x < view.width; ++x) {
+      const uint8_t cell = view.cells[y*view.width + x];
+      if (cell & Game::GHOST) {
+        out += "\033[2m[]\033[0m";
+      } else if (cell) {
+        out += "\033[4" + std::to_string(cell % 8) + "m  \033[0m";
+      } else {
+        out += "  ";
+      }
+    }
+    out += "|\033[K\n";
+  }
+  char status[128];
+  snprintf(status, sizeof(status), "tick %lu lines %d level %d next %d%s\033[K\n", view.tick, view.lines, view.level,
+           view.next_piece, view.game_over ? " game over" : "");
+  out += status;
+  fputs(out.c_str(), stdout);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  int clients = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    if (opt == 'n') {
+      clients = strtol(optarg, nullptr, 0);
+    } else {
+      optind = argc;
+    }
+  }
+  char host[256];
+  int port;
+  if (optind + 1 != argc || sscanf(argv[optind], "%255[^:]:%d", host, &port) != 2 || clients < 0) {
+    std::cerr << "usage: " << *argv << " [-n connections] host:port\n\n"
+              << "  Draws the game streamed on host:port, or with -n, receives it on that many connections and\n"
+              << "  reports how fast it arrives.\n";
+    return EXIT_FAILURE;
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* address;
+  const int ret = getaddrinfo(host, std::to_string(port).c_str(), &hints, &address);
+  if (ret) {
+    std::cerr << host << ": " << gai_strerror(ret) << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::vector<Connection> connections(std::max(clients, 1));
+  std::vector<struct pollfd> polls;
+  for (Connection& connection : connections) {
+    connection.fd = Connect(address);
+    connection.messages = 0;
+    if (connection.fd < 0) {
+      std::cerr << host << ":" << port << ": " << strerror(errno) << std::endl;
+      return EXIT_FAILURE;
+    }
+    polls.push_back(pollfd{.fd=connection.fd, .events=POLLIN, .revents=0});
+  }
+  freeaddrinfo(address);
+  if (!clients) {
+    fputs("\033[2J", stdout);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  auto reported = start;
+  uint64_t bytes = 0;
+  uint64_t reported_bytes = 0;
+  uint64_t reported_messages = 0;
+  int open = connections.size();
+  uint8_t data[65536];
+  while (open) {
+    if (poll(polls.data(), polls.size(), 1000) < 0 && errno != EINTR) {
+      perror("poll");
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < polls.size(); ++i) {
+      if (!polls[i].revents) {
+        continue;
+      }
+      Connection& connection = connections[i];
+      const ssize_t size = recv(connection.fd, data, sizeof(data), 0);
+      if (size <= 0) {
+        close(connection.fd);
+        polls[i].fd = -1;
+        --open;
+        continue;
+      }
+      bytes += size;
+      connection.buffer.insert(connection.buffer.end(), data, data + size);
+      const int decoded = Decode(&connection);
+      if (decoded < 0) {
+        std::cerr << "Bad message on connection " << i << std::endl;
+        return EXIT_FAILURE;
+      }
+      if (!clients && decoded && connection.decoder.ready()) {
+        Draw(connection.decoder.view());
+      }
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (clients && now - reported >= std::chrono::seconds(1)) {
+      uint64_t messages = 0;
+      uint64_t min_tick = UINT64_MAX;
+      uint64_t max_tick = 0;
+      for (const Connection& connection : connections) {
+        messages += connection.messages;
+        if (connection.decoder.ready()) {
+          min_tick = std::min(min_tick, connection.decoder.view().tick);
+          max_tick = std::max(max_tick, connection.decoder.view().tick);
+        }
+      }
+      const double seconds = std::chrono::duration<double>(now - reported).count();
+      printf("%d connected, %.0f messages/sec, %.0f KB/sec, ticks %lu to %lu\n", open,
+             (messages - reported_messages) / seconds, (bytes - reported_bytes) / seconds / 1024,
+             max_tick ? min_tick : 0, max_tick);
+      reported_messages = messages;
+      reported_bytes = bytes;
+      reported = now;
+    }
+  }
+  if (clients) {
+    // Every connection should have ended on the same view.
+    bool same = true;
+    for (const Connection& connection : connections) {
+      same &= connection.decoder.ready() && connection.decoder.view().tick == connections[0].decoder.view().tick &&
+              connection.decoder.view().cells == connections[0].decoder.view().cells;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu connections received %lu bytes in %.1f s, %s\n", connections.size(), bytes, seconds,
+           same ? "all ending on the same view" : "ending on different views");
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}